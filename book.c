@@ -0,0 +1,131 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "book.h"
+
+// Smallest state_hash of the position over all symmetries; sym gets the symmetry it was found in
+uint64_t book_key(state* st, int* sym) {
+	uint64_t best = UINT64_MAX;
+	for (int s = 0; s < BOOK_SYMMETRIES; ++s) {
+		uint64_t h = state_hash_transformed(st, s);
+		if (h < best) {
+			best = h;
+			*sym = s;
+		}
+	}
+	return best;
+}
+
+static int book_entry_cmp(const void* a, const void* b) {
+	const book_entry* ea = a;
+	const book_entry* eb = b;
+	if (ea->key != eb->key) {
+		return (ea->key < eb->key) ? -1 : 1;
+	}
+	return (ea->visits > eb->visits) ? -1 : (ea->visits < eb->visits);
+}
+
+// Maps a book written by book_save; returns NULL if missing or not matching this build
+book* book_load(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0 || (size_t) sb.st_size < sizeof(book_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t size = sb.st_size;
+	void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	const book_header* header = map;
+	if (memcmp(header->magic, BOOK_MAGIC, 4) != 0
+		|| header->version != BOOK_VERSION
+		|| header->width != WIDTH || header->height != HEIGHT
+		|| size != sizeof(book_header) + (size_t) header->count * sizeof(book_entry)) {
+		munmap(map, size);
+		return NULL;
+	}
+
+	book* bk = malloc(sizeof(book));
+	if (!bk) {
+		munmap(map, size);
+		return NULL;
+	}
+
+	bk->entries = (const book_entry*) (header + 1);
+	bk->count = header->count;
+	bk->map = map;
+	bk->size = size;
+
+	return bk;
+}
+
+void book_unload(book* bk) {
+	if (!bk) return;
+	munmap(bk->map, bk->size);
+	free(bk);
+}
+
+// Sorts entries in place, then writes them
+bool book_save(const char* path, book_entry* entries, uint32_t count) {
+	qsort(entries, count, sizeof(book_entry), book_entry_cmp);
+
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		return false;
+	}
+
+	book_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BOOK_MAGIC, 4);
+	header.version = BOOK_VERSION;
+	header.width = WIDTH;
+	header.height = HEIGHT;
+	header.count = count;
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(entries, sizeof(book_entry), count, f) == count;
+
+	return (fclose(f) == 0) && ok;
+}
+
+// Most visited move of the position, if it is in the book (binary search on the key)
+bool book_lookup(book* bk, state* st, move* mv) {
+	int sym = 0;
+	uint64_t key = book_key(st, &sym);
+
+	uint32_t lo = 0;
+	uint32_t hi = bk->count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (bk->entries[mid].key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == bk->count || bk->entries[lo].key != key) {
+		return false;
+	}
+
+	// Keys may collide; never trust an illegal move
+	move found = move_transform(bk->entries[lo].mv, sym, true);
+	if (!go_is_move_legal(st, &found)) {
+		return false;
+	}
+
+	*mv = found;
+	return true;
+}
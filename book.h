@@ -0,0 +1,52 @@
+#ifndef BOOK_H
+#define BOOK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "go.h"
+
+// Positions are looked up under the 8 symmetries of the board
+#define BOOK_SYMMETRIES 8
+
+#define BOOK_MAGIC "TBOK"
+#define BOOK_VERSION 1
+
+// Book file layout: header, book_entry entries[count] sorted by key, then by visits (most first)
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t count;
+	uint32_t reserved;
+} book_header;
+
+// What a search found out about one move of a position
+typedef struct {
+	uint64_t key;			// book_key of the position, komi & player to move included
+	uint32_t wins;			// For the player to move
+	uint32_t visits;
+	move mv;				// As seen in the symmetry the key was taken in
+	uint16_t reserved[3];
+} book_entry;
+
+// Read-only once loaded; may be shared by every thread
+typedef struct {
+	const book_entry* entries;
+	uint32_t count;
+	void* map;
+	size_t size;
+} book;
+
+uint64_t book_key(state*, int*);
+
+book* book_load(const char*);
+
+void book_unload(book*);
+
+bool book_save(const char*, book_entry*, uint32_t);
+
+bool book_lookup(book*, state*, move*);
+
+#endif
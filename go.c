@@ -17,7 +17,7 @@
 #define DOWN_OK  (i <= HEIGHT-2)
 
 
-INIT_MAKE_RANDI(42, 43);
+// move_random(rng*): random board move or pass
 #if COUNT >= 128 && COUNT <= 511
 	MAKE_RANDI512(move_random, -1, COUNT);
 #elif COUNT >= 32 && COUNT <= 127
@@ -27,6 +27,27 @@ INIT_MAKE_RANDI(42, 43);
 #endif
 
 
+// Random keys for state_hash; zobrist[c][i] for a stone of color c on point i, zobrist[EMPTY][i] for a ko on it
+static uint64_t zobrist[3][COUNT];
+static uint64_t zobrist_turn[3];
+static uint64_t zobrist_passes[4];
+static bool zobrist_ready = false;
+
+static void zobrist_init() {
+	uint64_t seed = 0x5EED;
+	for (int c = 0; c < 3; ++c) {
+		for (int i = 0; i < COUNT; ++i) {
+			zobrist[c][i] = splitmix64(&seed);
+		}
+		zobrist_turn[c] = splitmix64(&seed);
+	}
+	for (int p = 0; p < 4; ++p) {
+		zobrist_passes[p] = splitmix64(&seed);
+	}
+	zobrist_ready = true;
+}
+
+
 #ifdef __APPLE__
 wchar_t color_char(color player) {
 	if (player == BLACK) {
@@ -418,13 +439,8 @@ static void count_territory(dot* board, bool* already_counted, int i, int j, ter
 }
 
 
-// Malloc & init a state
-state* state_create() {
-	state* st;
-	if (!(st = (state*)malloc(sizeof(state)))) {
-		return NULL;
-	}
-
+// Empty board, Black to play, no komi
+static void state_init(state* st) {
 	st->nextPlayer = BLACK;
 	st->possibleKo = NO_POSSIBLE_KO;
 	st->passes = 0;
@@ -432,6 +448,11 @@ state* state_create() {
 	st->prisoners[WHITE] = 0.0;
 	st->komi = 0.0;
 
+	// Filled here, before anything can search
+	if (!zobrist_ready) {
+		zobrist_init();
+	}
+
 	dot* board = st->board;
 	for (int i = 0; i < COUNT; ++i) {
 		board[i].i = i;
@@ -455,6 +476,16 @@ state* state_create() {
 		gp->length = 0;
 		gp->freedoms = 0;
 	}
+}
+
+// Malloc & init a state
+state* state_create() {
+	state* st;
+	if (!(st = (state*)malloc(sizeof(state)))) {
+		return NULL;
+	}
+
+	state_init(st);
 	return st;
 }
 
@@ -529,7 +560,7 @@ void state_print(state* st) {
 
 	float score[3] = {0.0, 0.0, 0.0};
 
-	double t0 = timer_now();
+	uint64_t t0 = timer_now();
 	state_score(st, score, true);
 	double dt = timer_now() - t0;
 
@@ -593,7 +624,7 @@ void state_print_gtp(state* st) {
 
 	float score[3] = {0.0, 0.0, 0.0};
 
-	double t0 = timer_now();
+	uint64_t t0 = timer_now();
 	state_score(st, score, true);
 	double dt = timer_now() - t0;
 
@@ -614,7 +645,7 @@ void state_dump(state* st) {
 
 	wprintf(L"Komi is %.1f\n", st->komi);
 
-	double t0 = timer_now();
+	uint64_t t0 = timer_now();
 	for (int i = 0; i < COUNT; ++i) {
 		dot* stone = &board[i];
 		group* gp = stone->group;
@@ -651,6 +682,200 @@ void state_score(state* st, float* score, bool chinese_rules) {
 	}
 }
 
+// Adds an empty point to the region being flood-filled, or notes the color of the stone bordering it
+static inline void flood_region(dot* board, bool* already_counted, addr* region, int* n, color* border, int i, int j) {
+	color player = BOARD(i, j).player;
+	if (player != EMPTY) {
+		*border |= player;	// BLACK | WHITE == NEUTRAL
+	} else if (!ALREADY_COUNTED(i, j)) {
+		ALREADY_COUNTED(i, j) = true;
+		region[(*n)++] = i*WIDTH + j;
+	}
+}
+
+// Same as state_score with chinese rules, but also stores the owner of every point
+// Stones belong to their color, empty regions to the only color bordering them, or else to NEUTRAL
+void state_score_owners(state* st, float score[3], color owner[COUNT]) {
+	dot* board = st->board;
+
+	score[BLACK] = st->prisoners[BLACK];
+	score[WHITE] = st->prisoners[WHITE] + st->komi;
+
+	bool already_counted[COUNT];
+	memset(already_counted, (int) false, sizeof(bool) * COUNT);
+
+	addr region[COUNT];
+	for (int k = 0; k < COUNT; ++k) {
+		color player = board[k].player;
+		if (player != EMPTY) {
+			owner[k] = player;
+			++score[player];
+		} else if (!already_counted[k]) {
+			// Iterative flood fill of the empty region containing k
+			int n = 0;
+			color border = EMPTY;
+			already_counted[k] = true;
+			region[n++] = k;
+			for (int head = 0; head < n; ++head) {
+				int i = region[head] / WIDTH;
+				int j = region[head] - i * WIDTH;
+				if (UP_OK)    flood_region(board, already_counted, region, &n, &border, i-1, j);
+				if (LEFT_OK)  flood_region(board, already_counted, region, &n, &border, i, j-1);
+				if (RIGHT_OK) flood_region(board, already_counted, region, &n, &border, i, j+1);
+				if (DOWN_OK)  flood_region(board, already_counted, region, &n, &border, i+1, j);
+			}
+
+			color tr = (border == EMPTY) ? NEUTRAL : border;
+			for (int m = 0; m < n; ++m) {
+				owner[region[m]] = tr;
+			}
+			if (tr == BLACK || tr == WHITE) {
+				score[tr] += n;
+			}
+		}
+	}
+}
+
+// Key of a position: stones, ko point, player to move, consecutive passes & komi (never 0)
+uint64_t state_hash(state* st) {
+	uint64_t h = zobrist_turn[st->nextPlayer] ^ zobrist_passes[min(st->passes, 3)];
+	for (int i = 0; i < COUNT; ++i) {
+		if (st->board[i].player != EMPTY) {
+			h ^= zobrist[st->board[i].player][i];
+		}
+	}
+	if (st->possibleKo != NO_POSSIBLE_KO) {
+		h ^= zobrist[EMPTY][st->possibleKo];
+	}
+
+	uint64_t komi = (int64_t) (st->komi * 2);
+	h ^= splitmix64(&komi);
+
+	return h ? h : 1;
+}
+
+// Point mv under symmetry s of the (square) board: transposed if s & 1, then flipped top-bottom if s & 2,
+// left-right if s & 4; inverse undoes it
+move move_transform(move mv, int s, bool inverse) {
+	if (mv < 0) {
+		return mv;
+	}
+
+	int i = mv / WIDTH;
+	int j = mv - i * WIDTH;
+	if (!inverse && (s & 1)) { int tmp = i; i = j; j = tmp; }
+	if (s & 2) i = HEIGHT - 1 - i;
+	if (s & 4) j = WIDTH - 1 - j;
+	if (inverse && (s & 1)) { int tmp = i; i = j; j = tmp; }
+	return i * WIDTH + j;
+}
+
+// state_hash of the position seen through symmetry s (see move_transform)
+uint64_t state_hash_transformed(state* st, int s) {
+	uint64_t h = zobrist_turn[st->nextPlayer] ^ zobrist_passes[min(st->passes, 3)];
+	for (int i = 0; i < COUNT; ++i) {
+		if (st->board[i].player != EMPTY) {
+			h ^= zobrist[st->board[i].player][move_transform(i, s, false)];
+		}
+	}
+	if (st->possibleKo != NO_POSSIBLE_KO) {
+		h ^= zobrist[EMPTY][move_transform(st->possibleKo, s, false)];
+	}
+
+	uint64_t komi = (int64_t) (st->komi * 2);
+	h ^= splitmix64(&komi);
+
+	return h ? h : 1;
+}
+
+// Pack a position into a few bytes; groups are rebuilt by state_decode
+void state_encode(state* st, state_code* code) {
+	memset(code, 0, sizeof(state_code));
+	for (int i = 0; i < COUNT; ++i) {
+		code->stones[i / 4] |= st->board[i].player << (2 * (i % 4));
+	}
+	code->possibleKo = st->possibleKo;
+	code->nextPlayer = st->nextPlayer;
+	code->passes = st->passes;
+	code->prisoners[0] = st->prisoners[BLACK];
+	code->prisoners[1] = st->prisoners[WHITE];
+	code->komi = st->komi;
+}
+
+// Rebuild the position packed by state_encode; false if it isn't one
+// Stones of a group are played from one next to a liberty outwards, so every group has a liberty all along
+// & nothing gets captured on the way
+bool state_decode(state* st, state_code* code) {
+	color target[COUNT];
+	for (int i = 0; i < COUNT; ++i) {
+		target[i] = (code->stones[i / 4] >> (2 * (i % 4))) & 3;
+		if (target[i] == NEUTRAL) {
+			return false;
+		}
+	}
+	if (code->nextPlayer != BLACK && code->nextPlayer != WHITE) {
+		return false;
+	}
+	if (code->possibleKo != NO_POSSIBLE_KO && (code->possibleKo < 0 || code->possibleKo >= COUNT)) {
+		return false;
+	}
+
+	state_init(st);
+	dot* board = st->board;
+
+	addr queue[COUNT];
+	bool queued[COUNT] = {false};
+	for (int start = 0; start < COUNT; ++start) {
+		if (target[start] == EMPTY || queued[start]) continue;
+
+		// Only start from a stone next to a liberty
+		int i = start / WIDTH;
+		int j = start - i * WIDTH;
+		if (!((UP_OK && target[start - WIDTH] == EMPTY) || (LEFT_OK && target[start - 1] == EMPTY)
+			|| (RIGHT_OK && target[start + 1] == EMPTY) || (DOWN_OK && target[start + WIDTH] == EMPTY))) {
+			continue;
+		}
+
+		color friendly = target[start];
+		int head = 0;
+		int tail = 0;
+		queue[tail++] = start;
+		queued[start] = true;
+		while (head < tail) {
+			move mv = queue[head++];
+			st->nextPlayer = friendly;
+			if (go_play_move(st, &mv) != SUCCESS) {
+				return false;
+			}
+
+			i = mv / WIDTH;
+			j = mv - i * WIDTH;
+			int next[4] = {UP_OK ? mv - WIDTH : -1, LEFT_OK ? mv - 1 : -1, RIGHT_OK ? mv + 1 : -1, DOWN_OK ? mv + WIDTH : -1};
+			for (int k = 0; k < 4; ++k) {
+				if (next[k] >= 0 && target[next[k]] == friendly && !queued[next[k]]) {
+					queue[tail++] = next[k];
+					queued[next[k]] = true;
+				}
+			}
+		}
+	}
+
+	// Stones left over belong to groups without any liberty
+	for (int i = 0; i < COUNT; ++i) {
+		if (board[i].player != target[i]) {
+			return false;
+		}
+	}
+
+	st->nextPlayer = code->nextPlayer;
+	st->possibleKo = code->possibleKo;
+	st->passes = code->passes;
+	st->prisoners[BLACK] = code->prisoners[0];
+	st->prisoners[WHITE] = code->prisoners[1];
+	st->komi = code->komi;
+	return true;
+}
+
 color state_winner(state* st) {
 	if (st->passes == 2) {
 		float score[3];
@@ -1142,7 +1367,7 @@ move_result go_play_move(state* st, move* mv_ptr) {
 
 // Plays a "random" move & stores it in mv
 // TODO Since this never resigns, passes to lose, or fills own eyes, use is_move_reasonable instead?
-move_result go_play_random_move(state* st, move* mv, move* move_list) {
+move_result go_play_random_move(state* st, move* mv, move* move_list, rng* r) {
 	move tmp;
 	int timeout = COUNT;	// Heuristics
 	int rand_searches = 0;
@@ -1152,7 +1377,7 @@ move_result go_play_random_move(state* st, move* mv, move* move_list) {
 	dot* board = st->board;
 
 	do {
-		tmp = move_random();	// Random never resigns (mv = -2)
+		tmp = move_random(r);	// Random never resigns (mv = -2)
 		rand_searches++;
 
 		if (tmp == MOVE_PASS && st->passes == 1) {
@@ -1185,7 +1410,7 @@ move_result go_play_random_move(state* st, move* mv, move* move_list) {
 	int move_count = go_get_legal_moves(st, move_list);
 	if (move_count > 1) {
 		while (1) {
-			tmp = move_list[RANDI(0, move_count)];
+			tmp = move_list[RANDI(r, 0, move_count)];
 			if (tmp == MOVE_PASS && st->passes == 1) {
 				// Forbid deliberate losing by passing
 				float score[3];
@@ -1214,24 +1439,38 @@ move_result go_play_random_move(state* st, move* mv, move* move_list) {
 
 // Modifies st; stores result
 // Assumes game isn't over
-void go_play_out(state* st, playout_result* result) {
+void go_play_out(state* st, playout_result* result, rng* r) {
 	move mv;
 	move mv_list[COUNT+1];
+	memset(result->first, EMPTY, sizeof(result->first));
 	while (!go_is_game_over(st)) {
-		if (go_play_random_move(st, &mv, mv_list) != SUCCESS) {
+		color pl = st->nextPlayer;
+		if (go_play_random_move(st, &mv, mv_list, r) != SUCCESS) {
 			fwprintf(stderr, L"E: go_play_out couldn't play any moves\n");
+			state_score_owners(st, result->score, result->owner);	// Still filled, as the board was left
 			result->winner = EMPTY;
 			return;
 		}
+		if (mv >= 0 && result->first[mv] == EMPTY) {
+			result->first[mv] = pl;
+		}
 	}
 
-	float score[3] = {0.0, 0.0, 0.0};
-	state_score(st, score, true);
-
-	result->winner = (score[BLACK] > score[WHITE]) ? BLACK : WHITE;
+	go_get_result(st, result);
 	return;
 }
 
+// Stores winner, final score & owner of every point of a finished game
+void go_get_result(state* st, playout_result* result) {
+	state_score_owners(st, result->score, result->owner);
+
+	if (st->passes == 3) {
+		result->winner = st->nextPlayer;
+	} else {
+		result->winner = (result->score[BLACK] > result->score[WHITE]) ? BLACK : WHITE;
+	}
+}
+
 
 void go_print_heatmap(state* st, move* moves, double* values, int num_moves) {
 	dot* board = st->board;
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <wchar.h>
+#include "rand.h"
 
 #define WIDTH 9
 #define HEIGHT 9
@@ -70,12 +71,24 @@ typedef struct {
 	int area;
 } territory;
 
+// Position in a few bytes, e.g. for files (see state_encode)
+typedef struct {
+	uint8_t stones[(COUNT + 3) / 4];	// Color of every point, 2 bits each
+	int16_t possibleKo;
+	uint8_t nextPlayer;
+	uint8_t passes;
+	int16_t prisoners[2];		// Black's, then White's
+	float komi;
+} state_code;
+
 typedef int16_t move;
 
 typedef struct {
 	color winner;
 	// int t;
-	// float score[3];
+	float score[3];
+	color owner[COUNT];		// Final owner of every point (NEUTRAL if nobody's)
+	color first[COUNT];		// Who played first on every point during go_play_out (EMPTY if nobody)
 } playout_result;
 
 
@@ -94,6 +107,8 @@ void move_sprint(wchar_t str[3], move*);
 
 void move_print(move*);
 
+move move_transform(move, int, bool);
+
 
 state* state_create();
 
@@ -109,6 +124,16 @@ void state_dump(state*);
 
 void state_score(state*, float score[3], bool);
 
+void state_score_owners(state*, float score[3], color owner[COUNT]);
+
+uint64_t state_hash(state*);
+
+uint64_t state_hash_transformed(state*, int);
+
+void state_encode(state*, state_code*);
+
+bool state_decode(state*, state_code*);
+
 color state_winner(state*);
 
 
@@ -126,9 +151,11 @@ int go_get_reasonable_moves(state*, move move_list[NMOVES]);
 
 move_result go_play_move(state*, move*);
 
-move_result go_play_random_move(state*, move*, move*);
+move_result go_play_random_move(state*, move*, move*, rng*);
+
+void go_play_out(state*, playout_result*, rng*);
 
-void go_play_out(state*, playout_result*);
+void go_get_result(state*, playout_result*);
 
 
 void go_print_heatmap(state*, move*, double*, int);
@@ -55,6 +55,10 @@ def engine_vertex(s):
 
 	return '{}{}'.format(i, j)
 
+# Inverse of int(c, 36), as done by the engine's index_char
+def index_char(n):
+	return '0123456789abcdefghijklmnopqrstuvwxyz'[n]
+
 def gtp_vertex(s):
 	if s == '--':
 		return 'pass'
@@ -91,11 +95,15 @@ class GtpWrapper:
 		'fixed_handicap',
 		'place_free_handicap',
 		'set_free_handicap',
+		'time_settings',
 		'time_left',
+		'final_score',
+		'final_status_list',
 	}
 
-	def __init__(self, engine_path, debug=False, log_file=None):
-		self.engine = subprocess.Popen([engine_path, '-c'], stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+	# engine_args: extra engine options, e.g. ['-s', '42'] to replay a game with the same seed
+	def __init__(self, engine_path, engine_args=(), debug=False, log_file=None):
+		self.engine = subprocess.Popen([engine_path, '-c'] + list(engine_args), stdin=subprocess.PIPE, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
 		self._set_nonblocking(self.engine.stderr)
 		atexit.register(self._cleanup)
 
@@ -322,11 +330,61 @@ class GtpWrapper:
 
 		return OK, ''
 
+	def cmd_time_settings(self, main_time, byo_yomi_time, byo_yomi_stones):
+		try:
+			cmd = 'ts {} {} {}'.format(int(main_time, 10), int(byo_yomi_time, 10), int(byo_yomi_stones, 10))
+		except ValueError:
+			return ERROR, 'syntax error'
+
+		result = self.call_engine(cmd)
+
+		if result.startswith('!syntax'):
+			return ERROR, 'syntax error'
+
+		return OK, ''
+
 	def cmd_time_left(self, color, time, stones):
-		# TODO Implement, not just log
-		self._log('# time_left(color={}, time={}, stones={})\n'.format(color, time, stones))
+		try:
+			cmd = 'tl {} {} {}'.format(engine_color(color), int(time, 10), int(stones, 10))
+		except ValueError:
+			return ERROR, 'syntax error'
+
+		result = self.call_engine(cmd)
+
+		if result.startswith('!syntax'):
+			return ERROR, 'syntax error'
+
 		return OK, ''
 
+	def cmd_final_score(self):
+		result = self.call_engine('s')
+
+		if not re.search(r'^(?:[BW]\+\d+(?:\.\d+)?|0)$', result):
+			return ERROR, 'engine error: {}'.format(result)
+
+		return OK, result
+
+	# Stones whose point ends up owned by the opponent in most playouts are dead
+	def cmd_final_status_list(self, status):
+		if status not in ('alive', 'dead', 'seki'):
+			return ERROR, 'syntax error'
+
+		result = self.call_engine('o', multiline=True)
+
+		vertices = []
+		for i, row in enumerate(result.split('\n')):
+			for j, point in enumerate(row.split()):
+				stone, ownership = point[0], int(point[1:], 10)
+				if stone == '.':
+					continue
+
+				dead = (stone == 'x' and ownership < -50) or (stone == 'o' and ownership > 50)
+				if (status == 'dead' and dead) or (status == 'alive' and not dead):
+					vertices.append(gtp_vertex('{}{}'.format(index_char(i), index_char(j))))
+
+		# Seki is not detected
+		return OK, ' '.join(vertices)
+
 	def preprocess(self, line):
 		# [9, 10, 32, ..., 126]
 		whitelist = ''.join(chr(i) for i in [9, 10] + list(range(32, 127)))
@@ -394,12 +452,13 @@ def main():
 	parser.add_argument('engine', nargs='?', default='./go-teresa-9x9', help='path to game engine')
 	parser.add_argument('-d', action='store_true', help='debug mode')
 	parser.add_argument('-l', nargs='?', help='path to log file')
+	parser.add_argument('engine_args', nargs=argparse.REMAINDER, help='engine options, e.g. -s 42 -t 4')
 	args = parser.parse_args()
 
 	if args.l:
-		wrapper = GtpWrapper(args.engine, debug=args.d, log_file=open(args.l, 'a'))
+		wrapper = GtpWrapper(args.engine, args.engine_args, debug=args.d, log_file=open(args.l, 'a'))
 	else:
-		wrapper = GtpWrapper(args.engine, debug=args.d)
+		wrapper = GtpWrapper(args.engine, args.engine_args, debug=args.d)
 
 	while True:
 		line = input()
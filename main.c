@@ -1,10 +1,16 @@
 #include <locale.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 #include <wchar.h>
+#include "book.h"
 #include "go.h"
+#include "patterns.h"
 #include "players/human.h"
 #include "players/teresa.h"
+#include "timeman.h"
 #include "utils.h"
 
 /*
@@ -45,9 +51,60 @@ Commands supported:
 
 - g 1|2
   Calculate a move for the next player & print it (%c%c).
+  Thinks for a fixed number of playouts, or as the player's clock allows.
+  With -p, keeps thinking in the background until the next command.
   Errors: 
   - !result
 
+- ts %f %f %d
+  Set time controls of both players (as GTP time_settings): main time (s),
+  byo-yomi time (s) & stones per byo-yomi period.
+  Errors:
+  - !syntax
+
+- tl 1|2 %f %d
+  Set the time left for a player (as GTP time_left): seconds & stones left
+  in the current byo-yomi period (0 while in main time).
+  Errors:
+  - !syntax
+
+- o
+  Print the expected owner of every point, as seen by the last search (or
+  by a few fresh playouts if that search was about another position).
+  One line per row, each point as its stone (x, o or .) followed by the
+  percentage of playouts it ended up Black (positive) or White (negative).
+
+- s
+  Print the expected score, e.g. B+3.5, the same way.
+
+- i
+  Print statistics of Teresa: playouts per second of the last search, node
+  pool use, heap bytes outside the pool, transposition table counters,
+  share of the tree kept after the last move, then tree depth & branching
+  histograms as depth:nodes & children:nodes pairs.
+
+- f
+  Print where the time of the last search went, phase by phase (needs -P).
+  Errors:
+  - !profile
+
+- f %s
+  Write the same as a JSON object to a file.
+  Errors:
+  - !profile
+  - !file
+
+- w %s
+  Write Teresa's tree & the position it stands for to a snapshot file.
+  Errors:
+  - !file
+
+- l %s
+  Load a snapshot written by w: the position becomes the current state and
+  Teresa goes on from the tree that was saved.
+  Errors:
+  - !file
+
 - p
   Draw the current state.
 
@@ -62,12 +119,20 @@ void console_print_help(FILE* stream) {
 	fwprintf(stream, L"dg      Print a GTP-compatible drawing of the current state\n");
 	fwprintf(stream, L"h 3     Place 3 handicap stones at their predefined locations\n");
 	fwprintf(stream, L"k 6.5   Set komi to 6.5\n");
+	fwprintf(stream, L"o       Print the expected owner of every point\n");
+	fwprintf(stream, L"s       Print the expected score\n");
+	fwprintf(stream, L"i       Print search & memory statistics\n");
+	fwprintf(stream, L"f       Print the phase profile of the last search (f a.json to save it)\n");
 	fwprintf(stream, L"p 1 8b  Play move 8b as Black (player 1)\n");
 	fwprintf(stream, L"g 2     Calculate a move for White (player 2)\n");
+	fwprintf(stream, L"ts 300 30 5  Give both players 5 min, then 5 stones every 30 s\n");
+	fwprintf(stream, L"tl 1 42 3    Set Black's clock to 42 s left for 3 stones\n");
+	fwprintf(stream, L"w a.tree Save the search tree & current state to a.tree\n");
+	fwprintf(stream, L"l a.tree Load the search tree & state saved in a.tree\n");
 	fwprintf(stream, L"q       Quit\n");
 }
 
-int console_main() {
+int console_main(teresa_params* defaults) {
 	// Turn off output buffering so other scripts can interact with this console
 	setbuf(stdin, NULL);
 	setbuf(stdout, NULL);
@@ -78,18 +143,23 @@ int console_main() {
 
 	state* st = state_create();
 
-	int rolloutsPerSecond = 30000;
-	teresa_params teresap = {rolloutsPerSecond * 5, 0.5, 1.1, NULL, NULL};
+	teresa_params teresap = *defaults;
 	player teresa = {"genmove", &teresa_play, &teresa_observe, &teresap};
 
+	// No time control until ts is given
+	time_control clocks[3] = {{0}};
+
 	while (true) {
 		wprintf(L"> ");
 		fflush(stdout);
 
 		int result;
 
+		// Pondering (if on) lasts until the next command comes in
 		char input[256];
-		if (!fgets(input, 255, stdin)) {
+		char* got = fgets(input, 255, stdin);
+		teresa_ponder_stop(&teresa);
+		if (!got) {
 			if (feof(stdin)) {
 				wprintf(L"!feof\n");
 				return 0;
@@ -111,7 +181,10 @@ int console_main() {
 				break;
 			case '?':
 			case 'c':
+			case 'i':
+			case 'o':
 			case 'q':
+			case 's':
 			case 'v':
 				break;
 			case 'd':
@@ -127,10 +200,29 @@ int console_main() {
 						break;
 				}
 				break;
+			case 'f':
+				if (line[1] != '\0' && line[1] != ' ') {
+					wprintf(L"!syntax: Missing 1 space after command\n");
+					continue;
+				}
+				break;
+			case 't':
+				// ts or tl
+				if (line[1] != 's' && line[1] != 'l') {
+					wprintf(L"!command: t%c is not a command\n", line[1]);
+					continue;
+				}
+				if (line[2] != ' ') {
+					wprintf(L"!syntax: Missing 1 space after command\n");
+					continue;
+				}
+				break;
 			case 'h':
 			case 'k':
 			case 'p':
 			case 'g':
+			case 'w':
+			case 'l':
 				if (line[1] != ' ') {
 					wprintf(L"!syntax: Missing 1 space after command\n");
 					continue;
@@ -229,6 +321,82 @@ int console_main() {
 				st->komi = komi;
 				break;
 			}
+			case 'o': {
+				float ownership[COUNT];
+				float score;
+				teresa_estimate(&teresa, st, ownership, &score);
+
+				for (int i = 0; i < HEIGHT; ++i) {
+					for (int j = 0; j < WIDTH; ++j) {
+						color pl = st->board[i*WIDTH+j].player;
+						char stone = (pl == BLACK) ? 'x' : ((pl == WHITE) ? 'o' : '.');
+						wprintf(L"%c%+04d ", stone, (int) roundf(ownership[i*WIDTH+j] * 100));
+					}
+					wprintf(L"\n");
+				}
+				break;
+			}
+			case 's': {
+				float ownership[COUNT];
+				float score;
+				teresa_estimate(&teresa, st, ownership, &score);
+
+				if (score > 0) {
+					wprintf(L"B+%.1f", score);
+				} else if (score < 0) {
+					wprintf(L"W+%.1f", -score);
+				} else {
+					wprintf(L"0");
+				}
+				break;
+			}
+			case 'i': {
+				teresa_stats stats;
+				teresa_get_stats(&teresa, &stats);
+
+				wprintf(L"playouts %u in %.3f s (%.0f/s)\n", stats.playouts, stats.seconds,
+					stats.seconds > 0 ? stats.playouts / stats.seconds : 0.0);
+				wprintf(L"nodes %llu of %llu (%.1f%%), high water %llu, allocated %llu, released %llu\n",
+					(unsigned long long) stats.nodes, (unsigned long long) stats.capacity,
+					stats.capacity ? 100.0 * stats.nodes / stats.capacity : 0.0,
+					(unsigned long long) stats.high_water,
+					(unsigned long long) stats.allocated, (unsigned long long) stats.released);
+				wprintf(L"heap %llu bytes\n", (unsigned long long) stats.heap_bytes);
+				wprintf(L"transpositions %llu hits of %llu lookups, %llu playouts inherited, %llu left out\n",
+					(unsigned long long) stats.tt_hits, (unsigned long long) stats.tt_lookups,
+					(unsigned long long) stats.tt_inherited, (unsigned long long) stats.tt_full);
+				wprintf(L"reuse %.1f%%\n", 100.0 * stats.reuse);
+
+				wprintf(L"depth");
+				for (int d = 0; d < TERESA_STATS_DEPTH; ++d) {
+					if (stats.depth[d]) {
+						wprintf(L" %d:%u", d, stats.depth[d]);
+					}
+				}
+				wprintf(L"\nbranching");
+				for (int n = 0; n <= NMOVES; ++n) {
+					if (stats.branching[n]) {
+						wprintf(L" %d:%u", n, stats.branching[n]);
+					}
+				}
+				wprintf(L"\n");
+				break;
+			}
+			case 'f': {
+				if (!teresap.last_profile) {
+					wprintf(L"!profile: no search profiled (see -P)\n");
+					continue;
+				}
+
+				char path[256];
+				if (sscanf(line + 1, "%255s", path) != 1) {
+					teresa_profile_print(stdout, teresap.last_profile);
+				} else if (!teresa_profile_dump(teresap.last_profile, path)) {
+					wprintf(L"!file: could not write %s\n", path);
+					continue;
+				}
+				break;
+			}
 			case 'p': {
 				int player_in;
 				char mv_in[2];
@@ -275,6 +443,39 @@ int console_main() {
 				teresa.observe(&teresa, st, player, &mv);
 				break;
 			}
+			case 't': {
+				if (line[1] == 's') {
+					double main_time, byo_time;
+					int byo_stones;
+					result = sscanf(line + 3, "%lf %lf %d", &main_time, &byo_time, &byo_stones);
+
+					if (result != 3 || main_time < 0 || byo_time < 0 || byo_stones < 0) {
+						wprintf(L"!syntax: expected main time, byo-yomi time & stones\n");
+						continue;
+					}
+
+					timeman_settings(&clocks[BLACK], main_time, byo_time, byo_stones);
+					timeman_settings(&clocks[WHITE], main_time, byo_time, byo_stones);
+				} else {
+					int player_in;
+					double left;
+					int stones_left;
+					result = sscanf(line + 3, "%d %lf %d", &player_in, &left, &stones_left);
+
+					if (result != 3 || stones_left < 0) {
+						wprintf(L"!syntax: expected player, time & stones left\n");
+						continue;
+					}
+
+					if (player_in != 1 && player_in != 2) {
+						wprintf(L"!syntax: player %d is not 1 or 2\n", player_in);
+						continue;
+					}
+
+					timeman_left(&clocks[(player_in == 1) ? BLACK : WHITE], left, stones_left);
+				}
+				break;
+			}
 			case 'g': {
 				int player_in;
 				result = sscanf(line + 2, "%d", &player_in);
@@ -296,8 +497,12 @@ int console_main() {
 					teresa_reset(&teresa);
 				}
 
+				timeman_budget(&clocks[player], st, &teresap.soft_time, &teresap.hard_time);
+
+				uint64_t t0 = timer_now();
 				move mv;
 				move_result mv_result = teresa.play(&teresa, st, &mv);
+				timeman_spend(&clocks[player], (timer_now() - t0) / 1e9);
 				if (mv_result != SUCCESS) {
 					wprintf(L"!result: move_result is %d = ", mv_result);
 					go_print_move_result(mv_result);
@@ -305,6 +510,28 @@ int console_main() {
 				}
 
 				move_print(&mv);
+				teresa_ponder_start(&teresa, st);
+				break;
+			}
+			case 'w':
+			case 'l': {
+				char path[256];
+				result = sscanf(line + 2, "%255s", path);
+
+				if (result != 1) {
+					wprintf(L"!syntax: missing file name\n");
+					continue;
+				}
+
+				if (command == 'w' && !teresa_save(&teresa, st, path)) {
+					wprintf(L"!file: could not write %s\n", path);
+					continue;
+				}
+
+				if (command == 'l' && !teresa_load(&teresa, st, path)) {
+					wprintf(L"!file: %s is not a snapshot this build can load\n", path);
+					continue;
+				}
 				break;
 			}
 			case 'q': {
@@ -320,8 +547,8 @@ int console_main() {
 	return 0;
 }
 
-int game_main() {
-	long double t0, dt;
+int game_main(teresa_params* defaults) {
+	uint64_t t0, dt;
 
 	state* st = state_create();
 	st->komi = 6.5;
@@ -333,14 +560,12 @@ int game_main() {
 	// karl_params karlp = {80000};
 	// player karl = {"Karl", &karl_play, NULL, &karlp};
 
-	int rolloutsPerSecond = 30000;
-
-	teresa_params teresap = {rolloutsPerSecond * 5, 0.5, 1.1, NULL, NULL};
+	teresa_params teresap = *defaults;
 	player teresa = {"Teresa", &teresa_play, &teresa_observe, &teresap};
 
 	// teresa_old_node** r = &(teresap.old_root);
 
-	teresa_params teresa2p = {rolloutsPerSecond * 5, 0.5, 1.1, NULL, NULL};
+	teresa_params teresa2p = *defaults;
 	player teresa2 = {"Teresa 2", &teresa_play, &teresa_observe, &teresa2p};
 
 	// teresa_old_node** r2 = &(teresa2p.old_root);
@@ -349,7 +574,7 @@ int game_main() {
 	players[BLACK] = &teresa;
 	players[WHITE] = &teresa2;
 
-	long double sum_dt = 0;
+	uint64_t sum_dt = 0;
 
 	while (1) {
 		if (go_is_game_over(st)) {
@@ -372,13 +597,13 @@ int game_main() {
 		dt = timer_now() - t0;
 
 		if (result != SUCCESS) {
-			wprintf(L"%s has no more moves [%.2Lf ms]\n", pl->name, dt/1e6);
+			wprintf(L"%s has no more moves [%.2f ms]\n", pl->name, dt/1e6);
 			return 0;
 		}
 
 		wprintf(L"%lc %d %s played ", color_char(pl_color), t, pl->name);
 		move_print(&mv);
-		wprintf(L" [%.0Lf ms]\n", dt/1e6);
+		wprintf(L" [%.0f ms]\n", dt/1e6);
 
 		sum_dt += dt;
 
@@ -386,7 +611,7 @@ int game_main() {
 			t0 = timer_now();
 			opponent->observe(opponent, st, pl_color, &mv);
 			dt = timer_now() - t0;
-			wprintf(L"Opponent observed the move [%.0Lf ms]\n", dt/1e6);
+			wprintf(L"Opponent observed the move [%.0f ms]\n", dt/1e6);
 		}
 
 		wprintf(L"\n");
@@ -406,33 +631,145 @@ int game_main() {
 		wprintf(L"Game over: %lc wins by resignation\n", color_char(winner));
 	}
 
-	wprintf(L"Average thinking time: %.2Lf ms\n", sum_dt/t/1e6);
+	wprintf(L"Average thinking time: %.2f ms\n", (double) sum_dt/t/1e6);
 
 	return 0;
 }
 
 int main(int argc, char* argv[]) {
 	setlocale(LC_ALL, "");
-	seed_rand_once();
+
+	// Every Teresa starts from these
+	teresa_params defaults = TERESA_DEFAULT_PARAMS;
 
 	// Parse command line arguments
 	int opt;
 	bool console = false;
-	while ((opt = getopt(argc, argv, "c")) != -1) {
+	const char* patterns_path = NULL;
+	const char* book_path = NULL;
+	int threads = defaults.threads;
+	int virtual_loss = defaults.virtual_loss;
+	teresa_parallel_mode parallel = defaults.parallel;
+	int batch = 0;
+	bool ponder = false;
+	size_t memory = 0;
+	size_t tt_memory = 0;
+	float rave = defaults.rave;
+	float bias = defaults.bias;
+	int widen = defaults.widen;
+	float confidence = 0;
+	int profile = 0;
+	uint64_t seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+	while ((opt = getopt(argc, argv, "a:b:B:ce:H:m:pP:rs:t:v:w:W:z:")) != -1) {
 		switch (opt) {
+			case 'a':
+				rave = atof(optarg);
+				break;
+			case 'b':
+				batch = max(atoi(optarg), 1);
+				break;
+			case 'B':
+				book_path = optarg;
+				break;
 			case 'c':
 				console = true;
 				break;
+			case 'e':
+				bias = fmax(atof(optarg), 0);
+				break;
+			case 'H':
+				tt_memory = (size_t) max(atoi(optarg), 1) << 20;
+				break;
+			case 'l':
+				parallel = TERESA_LEAF_PARALLEL;
+				break;
+			case 'm':
+				memory = (size_t) strtoull(optarg, NULL, 10) << 20;
+				break;
+			case 'p':
+				ponder = true;
+				break;
+			case 'P':
+				profile = max(atoi(optarg), 1);
+				break;
+			case 'r':
+				parallel = TERESA_ROOT_PARALLEL;
+				break;
+			case 's':
+				seed = strtoull(optarg, NULL, 10);
+				break;
+			case 't':
+				threads = max(atoi(optarg), 1);
+				break;
+			case 'v':
+				virtual_loss = max(atoi(optarg), 0);
+				break;
+			case 'w':
+				patterns_path = optarg;
+				break;
+			case 'W':
+				widen = max(atoi(optarg), 0);
+				break;
+			case 'z':
+				confidence = atof(optarg);
+				break;
 			default:
-				fwprintf(stderr, L"Usage: %s [-c]\n", argv[0]);
+				fwprintf(stderr, L"Usage: %s [-a rave] [-b batch] [-B book.bin] [-c] [-e bias] [-H megabytes] [-l|-r] [-m megabytes] [-p] [-P every] [-s seed] [-t threads] [-v losses] [-w weights.bin] [-W children] [-z confidence]\n", argv[0]);
 				return 1;
 				break;
 		}
 	}
 
+	timer_calibrate();
+
+	// Logged so any run can be reproduced with -s
+	seed_rand(seed);
+	fwprintf(stderr, L"Seed %llu\n", (unsigned long long) seed);
+
+	// Pattern weights (see train.c) are mapped as is
+	patterns_init();
+	pattern_table* patterns = NULL;
+	if (patterns_path) {
+		patterns = patterns_load(patterns_path);
+		if (!patterns) {
+			fwprintf(stderr, L"Could not load pattern weights from %s\n", patterns_path);
+			return 1;
+		}
+	}
+
+	// Opening book (see mkbook.c), mapped as is too
+	book* bk = NULL;
+	if (book_path) {
+		bk = book_load(book_path);
+		if (!bk) {
+			fwprintf(stderr, L"Could not load opening book from %s\n", book_path);
+			return 1;
+		}
+	}
+
+	// Leaf-parallel helpers need at least one playout each
+	if (!batch) {
+		batch = (parallel == TERESA_LEAF_PARALLEL) ? threads : 1;
+	}
+
+	defaults.confidence = confidence;
+	defaults.rave = rave;
+	defaults.bias = bias;
+	defaults.widen = widen;
+	defaults.threads = threads;
+	defaults.virtual_loss = virtual_loss;
+	defaults.parallel = parallel;
+	defaults.batch = batch;
+	defaults.ponder = ponder;
+	defaults.memory = memory;
+	defaults.tt_memory = tt_memory;
+	defaults.profile = profile;
+	defaults.patterns = patterns;
+	defaults.book = bk;
+
 	if (console) {
-		return console_main();
+		return console_main(&defaults);
 	} else {
-		return game_main();
+		return game_main(&defaults);
 	}
 }
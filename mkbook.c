@@ -0,0 +1,216 @@
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+#include "book.h"
+#include "go.h"
+#include "patterns.h"
+#include "players.h"
+#include "players/teresa.h"
+#include "utils.h"
+
+/*
+Offline opening book builder
+
+Usage: mkbook.x [-d plies] [-n playouts] [-b breadth] [-k komi] [-s seed] [-t threads] [-w weights.bin] [-o book.bin]
+
+Searches the empty board with Teresa for the given number of playouts and
+records its most visited moves with their statistics; then does the same
+from the position after each of them, down to the given number of plies.
+Positions are keyed up to symmetry (see book_key), so one reached twice, or
+in another orientation, is only searched once. Keys include komi: a book is
+only used in games with the komi it was built for. With -s and one thread,
+the same seed builds the same book.
+
+The book is written sorted by key, in the format mapped by book_load.
+*/
+
+typedef struct {
+	player* teresa;
+	int breadth;
+
+	book_entry* entries;
+	uint32_t count;
+	uint32_t cap;
+
+	uint64_t* seen;
+	uint32_t nseen;
+	uint32_t cap_seen;
+} book_builder;
+
+static void* xrealloc(void* ptr, size_t size) {
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		fwprintf(stderr, L"E: out of memory\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+// Marks the key as seen; false if it already was
+static bool book_builder_visit(book_builder* b, uint64_t key) {
+	for (uint32_t i = 0; i < b->nseen; ++i) {
+		if (b->seen[i] == key) {
+			return false;
+		}
+	}
+
+	if (b->nseen == b->cap_seen) {
+		b->cap_seen = b->cap_seen ? 2 * b->cap_seen : 256;
+		b->seen = xrealloc(b->seen, b->cap_seen * sizeof(uint64_t));
+	}
+	b->seen[b->nseen++] = key;
+	return true;
+}
+
+static void book_builder_push(book_builder* b, uint64_t key, move mv, uint32_t wins, uint32_t visits) {
+	if (b->count == b->cap) {
+		b->cap = b->cap ? 2 * b->cap : 256;
+		b->entries = xrealloc(b->entries, b->cap * sizeof(book_entry));
+	}
+
+	book_entry* entry = &b->entries[b->count++];
+	memset(entry, 0, sizeof(book_entry));
+	entry->key = key;
+	entry->wins = wins;
+	entry->visits = visits;
+	entry->mv = mv;
+}
+
+// Search st, record its best moves, & go on from each of them until plies run out
+static void book_builder_expand(book_builder* b, state* st, int plies) {
+	if (plies <= 0 || go_is_game_over(st)) {
+		return;
+	}
+
+	int sym = 0;
+	uint64_t key = book_key(st, &sym);
+	if (!book_builder_visit(b, key)) {
+		return;
+	}
+
+	uint64_t t0 = timer_now();
+
+	move moves[NMOVES];
+	uint32_t wins[NMOVES];
+	uint32_t visits[NMOVES];
+	teresa_reset(b->teresa);
+	int n = min(teresa_analyze(b->teresa, st, moves, wins, visits), b->breadth);
+
+	for (int i = 0; i < n; ++i) {
+		book_builder_push(b, key, move_transform(moves[i], sym, false), wins[i], visits[i]);
+	}
+
+	fwprintf(stderr, L"Position %u (%d plies left): ", b->nseen, plies);
+	for (int i = 0; i < n; ++i) {
+		wchar_t str[3];
+		move_sprint(str, &moves[i]);
+		fwprintf(stderr, L"%ls %.1f%% (%u)  ", str, 100.0 * wins[i] / visits[i], visits[i]);
+	}
+	fwprintf(stderr, L"[%.1f s]\n", (timer_now() - t0)/1e9);
+
+	for (int i = 0; i < n; ++i) {
+		state next;
+		state_copy(st, &next);
+		if (go_play_move(&next, &moves[i]) == SUCCESS) {
+			book_builder_expand(b, &next, plies - 1);
+		}
+	}
+}
+
+int main(int argc, char* argv[]) {
+	setlocale(LC_ALL, "");
+	patterns_init();
+
+	int plies = 4;
+	int playouts = 1000000;
+	int breadth = 2;
+	float komi = 6.5;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	const char* patterns_path = NULL;
+	const char* out_path = "book.bin";
+	uint64_t seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+
+	int opt;
+	while ((opt = getopt(argc, argv, "d:n:b:k:s:t:w:o:")) != -1) {
+		switch (opt) {
+			case 'd':
+				plies = atoi(optarg);
+				break;
+			case 'n':
+				playouts = atoi(optarg);
+				break;
+			case 'b':
+				breadth = atoi(optarg);
+				break;
+			case 'k':
+				komi = atof(optarg);
+				break;
+			case 's':
+				seed = strtoull(optarg, NULL, 10);
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 'w':
+				patterns_path = optarg;
+				break;
+			case 'o':
+				out_path = optarg;
+				break;
+			default:
+				fwprintf(stderr, L"Usage: %s [-d plies] [-n playouts] [-b breadth] [-k komi] [-s seed] [-t threads] [-w weights.bin] [-o book.bin]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (plies < 1 || playouts < 1 || breadth < 1 || threads < 1) {
+		fwprintf(stderr, L"Usage: %s [-d plies] [-n playouts] [-b breadth] [-k komi] [-s seed] [-t threads] [-w weights.bin] [-o book.bin]\n", argv[0]);
+		return 1;
+	}
+
+	timer_calibrate();
+	seed_rand(seed);
+	fwprintf(stderr, L"Seed %llu\n", (unsigned long long) seed);
+
+	pattern_table* patterns = NULL;
+	if (patterns_path) {
+		patterns = patterns_load(patterns_path);
+		if (!patterns) {
+			fwprintf(stderr, L"E: could not load pattern weights from %s\n", patterns_path);
+			return 1;
+		}
+	}
+
+	// The engine's defaults, but a fixed (long) search & all cores on one tree
+	teresa_params teresap = TERESA_DEFAULT_PARAMS;
+	teresap.N = playouts;
+	teresap.threads = threads;
+	teresap.parallel = TERESA_TREE_PARALLEL;
+	teresap.patterns = patterns;
+	player teresa = {"Teresa", &teresa_play, &teresa_observe, &teresap};
+
+	uint64_t t0 = timer_now();
+
+	book_builder b;
+	memset(&b, 0, sizeof(b));
+	b.teresa = &teresa;
+	b.breadth = breadth;
+
+	state* st = state_create();
+	st->komi = komi;
+	book_builder_expand(&b, st, plies);
+	state_destroy(st);
+
+	if (!book_save(out_path, b.entries, b.count)) {
+		fwprintf(stderr, L"E: could not write %s\n", out_path);
+		return 1;
+	}
+
+	fwprintf(stderr, L"Wrote %u moves of %u positions to %s [%.1f s]\n", b.count, b.nseen, out_path, (timer_now() - t0)/1e9);
+
+	return 0;
+}
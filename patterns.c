@@ -0,0 +1,191 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "patterns.h"
+
+// Offsets of the neighborhood; 3x3 first (in reading order), then the outer diamond
+static const int pattern_di[PATTERN_POINTS] = {-1, -1, -1,  0,  0,  1,  1,  1, -2,  0,  0,  2};
+static const int pattern_dj[PATTERN_POINTS] = {-1,  0,  1, -1,  1, -1,  0,  1,  0, -2,  2,  0};
+
+// pattern_perm[s][k]: which point lands in slot k under symmetry s
+static int pattern_perm[PATTERN_SYMMETRIES][PATTERN_POINTS];
+static uint16_t canon_3x3[PATTERN_3X3_COUNT];
+static bool patterns_ready = false;
+
+// Maps a 3x3 code (2 bits per slot) through symmetry s
+static inline uint16_t code_3x3_transform(uint16_t code, int s) {
+	uint16_t out = 0;
+	for (int k = 0; k < 8; ++k) {
+		out |= ((code >> (2 * pattern_perm[s][k])) & 3) << (2 * k);
+	}
+	return out;
+}
+
+// Build symmetry permutations & canonical 3x3 codes; call once before any other function
+void patterns_init() {
+	if (patterns_ready) return;
+
+	for (int s = 0; s < PATTERN_SYMMETRIES; ++s) {
+		for (int k = 0; k < PATTERN_POINTS; ++k) {
+			int di = pattern_di[k];
+			int dj = pattern_dj[k];
+			if (s & 1) { int tmp = di; di = dj; dj = tmp; }
+			if (s & 2) di = -di;
+			if (s & 4) dj = -dj;
+
+			for (int l = 0; l < PATTERN_POINTS; ++l) {
+				if (pattern_di[l] == di && pattern_dj[l] == dj) {
+					pattern_perm[s][k] = l;
+					break;
+				}
+			}
+		}
+	}
+
+	for (int code = 0; code < PATTERN_3X3_COUNT; ++code) {
+		uint16_t best = code;
+		for (int s = 1; s < PATTERN_SYMMETRIES; ++s) {
+			uint16_t other = code_3x3_transform(code, s);
+			if (other < best) best = other;
+		}
+		canon_3x3[code] = best;
+	}
+
+	patterns_ready = true;
+}
+
+// 0 empty, 1 friendly, 2 enemy, 3 off-board; +4 if stone is in atari (and atari is asked for)
+// Note: group freedoms count stone-liberty contacts, so only ataris with a single contact are seen
+static inline int pattern_point(state* st, color friendly, int i, int j, bool with_atari) {
+	if (i < 0 || i >= HEIGHT || j < 0 || j >= WIDTH) {
+		return 3;
+	}
+
+	dot* stone = &st->board[i*WIDTH + j];
+	if (stone->player == EMPTY) {
+		return 0;
+	}
+
+	int v = (stone->player == friendly) ? 1 : 2;
+	if (with_atari && stone->group->freedoms == 1) {
+		v |= 4;
+	}
+	return v;
+}
+
+// Symmetry-invariant pattern ids of a board move for the player to move
+void pattern_features(state* st, move mv, uint16_t* p3, uint32_t* plarge) {
+	color friendly = st->nextPlayer;
+	int i = mv / WIDTH;
+	int j = mv - i * WIDTH;
+
+	int v[PATTERN_POINTS];
+	uint16_t code = 0;
+	for (int k = 0; k < PATTERN_POINTS; ++k) {
+		// Atari flags on the 4 adjacent points only
+		bool adjacent = abs(pattern_di[k]) + abs(pattern_dj[k]) == 1;
+		v[k] = pattern_point(st, friendly, i + pattern_di[k], j + pattern_dj[k], adjacent);
+		if (k < 8) {
+			code |= (v[k] & 3) << (2 * k);
+		}
+	}
+	*p3 = canon_3x3[code];
+
+	uint64_t best = UINT64_MAX;
+	for (int s = 0; s < PATTERN_SYMMETRIES; ++s) {
+		uint64_t large = 0;
+		for (int k = 0; k < PATTERN_POINTS; ++k) {
+			large |= (uint64_t) v[pattern_perm[s][k]] << (3 * k);
+		}
+		if (large < best) best = large;
+	}
+	*plarge = (uint32_t) ((best * 0x9E3779B97F4A7C15ULL) >> (64 - PATTERN_LARGE_BITS));
+}
+
+// Maps a weights file written by patterns_save; returns NULL if missing or not matching this build
+pattern_table* patterns_load(const char* path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0 || (size_t) sb.st_size < sizeof(pattern_header)) {
+		close(fd);
+		return NULL;
+	}
+
+	size_t size = sb.st_size;
+	void* map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	const pattern_header* header = map;
+	size_t expected = sizeof(pattern_header) + (PATTERN_3X3_COUNT + PATTERN_LARGE_COUNT) * sizeof(float);
+	if (memcmp(header->magic, PATTERN_MAGIC, 4) != 0
+		|| header->version != PATTERN_VERSION
+		|| header->width != WIDTH || header->height != HEIGHT
+		|| header->n_3x3 != PATTERN_3X3_COUNT || header->n_large != PATTERN_LARGE_COUNT
+		|| size != expected) {
+		munmap(map, size);
+		return NULL;
+	}
+
+	pattern_table* table = malloc(sizeof(pattern_table));
+	if (!table) {
+		munmap(map, size);
+		return NULL;
+	}
+
+	table->gamma_3x3 = (const float*) (header + 1);
+	table->gamma_large = table->gamma_3x3 + PATTERN_3X3_COUNT;
+	table->map = map;
+	table->size = size;
+
+	return table;
+}
+
+void patterns_unload(pattern_table* table) {
+	if (!table) return;
+	munmap(table->map, table->size);
+	free(table);
+}
+
+bool patterns_save(const char* path, const float* gamma_3x3, const float* gamma_large) {
+	FILE* f = fopen(path, "wb");
+	if (!f) {
+		return false;
+	}
+
+	pattern_header header;
+	memcpy(header.magic, PATTERN_MAGIC, 4);
+	header.version = PATTERN_VERSION;
+	header.width = WIDTH;
+	header.height = HEIGHT;
+	header.n_3x3 = PATTERN_3X3_COUNT;
+	header.n_large = PATTERN_LARGE_COUNT;
+
+	bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(gamma_3x3, sizeof(float), PATTERN_3X3_COUNT, f) == PATTERN_3X3_COUNT
+		&& fwrite(gamma_large, sizeof(float), PATTERN_LARGE_COUNT, f) == PATTERN_LARGE_COUNT;
+
+	return (fclose(f) == 0) && ok;
+}
+
+// Strength of a move according to the table (1 for passes)
+float pattern_gamma(pattern_table* table, state* st, move mv) {
+	if (mv < 0) {
+		return 1.0;
+	}
+
+	uint16_t p3;
+	uint32_t plarge;
+	pattern_features(st, mv, &p3, &plarge);
+	return table->gamma_3x3[p3] * table->gamma_large[plarge];
+}
@@ -0,0 +1,53 @@
+#ifndef PATTERNS_H
+#define PATTERNS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "go.h"
+
+// Neighborhood of a move: 3x3 square, plus the 4 points 2 away in a straight line
+#define PATTERN_POINTS 12
+#define PATTERN_SYMMETRIES 8
+
+// 3x3 patterns: 2 bits per neighbor (empty, friendly, enemy, edge), indexed directly
+#define PATTERN_3X3_COUNT 65536
+
+// Large patterns (with atari flags on the 4 adjacent points) are hashed into buckets
+#define PATTERN_LARGE_BITS 20
+#define PATTERN_LARGE_COUNT (1 << PATTERN_LARGE_BITS)
+
+#define PATTERN_MAGIC "TPAT"
+#define PATTERN_VERSION 1
+
+// Weights file layout: header, float gamma_3x3[n_3x3], float gamma_large[n_large]
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t n_3x3;
+	uint32_t n_large;
+} pattern_header;
+
+// Read-only once loaded; may be shared by every thread
+typedef struct {
+	const float* gamma_3x3;
+	const float* gamma_large;
+	void* map;
+	size_t size;
+} pattern_table;
+
+void patterns_init();
+
+void pattern_features(state*, move, uint16_t*, uint32_t*);
+
+pattern_table* patterns_load(const char*);
+
+void patterns_unload(pattern_table*);
+
+bool patterns_save(const char*, const float*, const float*);
+
+float pattern_gamma(pattern_table*, state*, move);
+
+#endif
@@ -2,7 +2,12 @@
 #include "utils.h"
 
 move_result karl_play(player* self, state* st, move* mv) {
-	int N = ((karl_params*) self->params)->N;
+	karl_params* params = (karl_params*) self->params;
+	int N = params->N;
+	rng* r = &params->rng;
+	if (!rng_is_seeded(r)) {
+		rng_init(r);
+	}
 
 	state test_st;
 
@@ -31,12 +36,12 @@ move_result karl_play(player* self, state* st, move* mv) {
 	for (int i = 0; i < N; ++i) {
 		state_copy(st, &test_st);
 
-		int starting_move_idx = RANDI(0, num_moves);
+		int starting_move_idx = RANDI(r, 0, num_moves);
 		move starting_move = reasonable_moves[starting_move_idx];
 		go_play_move(&test_st, &starting_move);
 
 		playout_result result;
-		go_play_out(&test_st, &result);
+		go_play_out(&test_st, &result, r);
 
 		if (result.winner == me) {
 			++win[starting_move_idx];
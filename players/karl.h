@@ -5,6 +5,7 @@
 
 typedef struct {
 	int N;
+	rng rng;	// Seeded on first play
 } karl_params;
 
 move_result karl_play(player*, state*, move*);
@@ -1,10 +1,17 @@
 #include "players/randy.h"
 #include "go.h"
+#include "utils.h"
+
+// Randy has no params, so shares one context (not reentrant)
+static rng randy_rng;
 
 // Have bot play one move given current state
 move_result randy_play(player* self, state* st, move* mv) {
 	self = self;
+	if (!rng_is_seeded(&randy_rng)) {
+		rng_init(&randy_rng);
+	}
 	move move_list[NMOVES];
-	return go_play_random_move(st, mv, move_list);
+	return go_play_random_move(st, mv, move_list, &randy_rng);
 }
 
@@ -1,8 +1,19 @@
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <wchar.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "players.h"
 #include "players/teresa.h"
 #include "utils.h"
@@ -11,265 +22,907 @@
 // Matching undefs at bottom of this file
 #define NODE_NULL 0										// Set nodes to NODE_NULL instead of 0 for clarity
 #define NODE_PARENT(node) (tree->parent[(node)])
-#define NODE_SIBLING(node) (tree->sibling[(node)])
 #define NODE_CHILD(node) (tree->child[(node)])
-#define NODE_PL(node) (tree->pl[(node)])
+#define NODE_NCHILDREN(node) (tree->nchildren[(node)])
+#define NODE_FLAGS(node) (tree->flags[(node)])
 #define NODE_MV(node) (tree->mv[(node)])
-#define NODE_WINS(node) (tree->wins[(node)])
-#define NODE_VISITS(node) (tree->visits[(node)])
-#define NODE_PWIN(node) (tree->pwin[(node)])
-#define NODE_SQLG_VISITS(node) (tree->sqlg_visits[(node)])
-#define NODE_RSQRT_VISITS(node) (tree->rsqrt_visits[(node)])
-#define NODE_UNEXPLORED_MOVES(node) (tree->unexplored_moves[(node)])
-#define NODE_UNEXPLORED_COUNT(node) (tree->unexplored_count[(node)])
+#define NODE_STATS(node) (tree->stats[(node)])
+#define NODE_WINS(node) ((uint32_t) NODE_STATS(node))
+#define NODE_VISITS(node) ((uint32_t) (NODE_STATS(node) >> 32))
+#define NODE_AMAF(node) (tree->amaf[(node)])
+
+#define STATS(wins, visits) ((uint64_t) (visits) << 32 | (wins))
+
+#define AMAF(prior, wins, visits) ((uint32_t) (prior) << 24 | (visits) << 12 | (wins))
+#define AMAF_VISITS(amaf) (((amaf) >> 12) & 0xFFF)
+#define AMAF_WINS(amaf) ((amaf) & 0xFFF)
+#define AMAF_PRIOR(amaf) ((amaf) >> 24)
+
+#define TERESA_FLAG_EXPANDED 1
+// Proven results (see teresa_prove), for whoever moved into the node
+#define TERESA_FLAG_WON 2
+#define TERESA_FLAG_LOST 4
+#define TERESA_FLAG_PROVEN (TERESA_FLAG_WON | TERESA_FLAG_LOST)
+// Walked into once, & tied to the transposition table then (see teresa_tt_link)
+#define TERESA_FLAG_LINKED 8
+// Playouts a node inherited from the transposition table, in the remaining bits
+#define TERESA_FLAG_INHERITED_SHIFT 4
+
+// Visits of its own, the ones counted when choosing between moves
+#define NODE_INHERITED(node) (NODE_FLAGS(node) >> TERESA_FLAG_INHERITED_SHIFT)
+#define NODE_OWN_VISITS(node) (NODE_VISITS(node) - NODE_INHERITED(node))
+
+// utils.h's min & max take ints; counts here may not fit one
+static inline uint32_t min_u32(uint32_t a, uint32_t b) {
+	return (a < b) ? a : b;
+}
+
+static inline size_t min_size(size_t a, size_t b) {
+	return (a < b) ? a : b;
+}
 
-static unsigned int teresa_node_count = 0;
+static inline size_t max_size(size_t a, size_t b) {
+	return (a > b) ? a : b;
+}
 
 static inline void teresa_node_init(teresa_tree* tree, teresa_node node) {
 	NODE_PARENT(node) = NODE_NULL;
-	NODE_SIBLING(node) = NODE_NULL;
 	NODE_CHILD(node) = NODE_NULL;
-	NODE_PL(node) = NEUTRAL;
+	NODE_NCHILDREN(node) = 0;
+	NODE_FLAGS(node) = 0;
 	NODE_MV(node) = MOVE_PASS;
-	NODE_WINS(node) = 0;
-	NODE_VISITS(node) = 0;
-	NODE_PWIN(node) = NAN;
-	NODE_SQLG_VISITS(node) = NAN;
-	NODE_RSQRT_VISITS(node) = NAN;
-	NODE_UNEXPLORED_MOVES(node) = NULL;
-	NODE_UNEXPLORED_COUNT(node) = 0;
+	NODE_STATS(node) = 0;
+	NODE_AMAF(node) = AMAF(TERESA_PRIOR_ONE, 0, 0);
+}
+
+// sqrt(log(n)) & 1/sqrt(n) for small n; filled once by teresa_tables_init
+static float teresa_sqlg_table[TERESA_UCB_TABLE_SIZE];
+static float teresa_rsqrt_table[TERESA_UCB_TABLE_SIZE];
+static bool teresa_tables_ready = false;
+
+static void teresa_tables_init() {
+	if (teresa_tables_ready) return;
+
+	teresa_sqlg_table[0] = 0;
+	teresa_rsqrt_table[0] = INFINITY;
+	for (int n = 1; n < TERESA_UCB_TABLE_SIZE; ++n) {
+		teresa_sqlg_table[n] = sqrtf(logf(n));
+		teresa_rsqrt_table[n] = 1 / sqrtf(n);
+	}
+
+	teresa_tables_ready = true;
+}
+
+// log2 of x >= 1 from the float's exponent, with a quadratic for the mantissa (error < 0.005)
+static inline float fast_log2(float x) {
+	union { float f; uint32_t i; } u = {x};
+	float e = (float) ((int) (u.i >> 23) - 128);	// Quadratic below gives log2 of the mantissa plus 1
+	u.i = (u.i & 0x007FFFFF) | 0x3F800000;
+	float m = u.f;
+	return e + (-0.34484843f * m + 2.02466578f) * m - 0.67487759f;
+}
+
+static inline float sqlg(uint32_t n) {
+	return (n < TERESA_UCB_TABLE_SIZE) ? teresa_sqlg_table[n] : sqrtf(fast_log2(n) * (float) M_LN2);
+}
+
+static inline float rsqrt(uint32_t n) {
+	return (n < TERESA_UCB_TABLE_SIZE) ? teresa_rsqrt_table[n] : 1 / sqrtf(n);
 }
 
 static inline float node_pwin(teresa_tree* tree, teresa_node nd) {
-	return isnan(NODE_PWIN(nd)) ? (NODE_PWIN(nd) = (float)NODE_WINS(nd)/NODE_VISITS(nd)) : NODE_PWIN(nd);
+	return (float)NODE_WINS(nd)/NODE_VISITS(nd);
 }
 
-static inline float node_sqlg_visits(teresa_tree* tree, teresa_node nd) {
-	return isnan(NODE_SQLG_VISITS(nd)) ? (NODE_SQLG_VISITS(nd) = sqrt(log((float)NODE_VISITS(nd)))) : NODE_SQLG_VISITS(nd);
+#define FREELIST_NODE(head) ((teresa_node) (head))
+#define FREELIST_NEXT(head, node) ((((head) >> 32) + 1) << 32 | (node))
+
+// Every array of the tree, in reservation order
+#define TERESA_TREE_ARRAYS(X) \
+	X(parent) X(child) X(nchildren) X(flags) X(mv) X(stats) X(amaf)
+
+static inline size_t page_round(size_t bytes) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (bytes + page - 1) & ~(page - 1);
 }
 
-static inline float node_rsqrt_visits(teresa_tree* tree, teresa_node nd) {
-	return isnan(NODE_RSQRT_VISITS(nd)) ? (NODE_RSQRT_VISITS(nd) = 1 / sqrt((float)NODE_VISITS(nd))) : NODE_RSQRT_VISITS(nd);
+// Memory taken by one node across all arrays
+static size_t teresa_node_bytes() {
+	teresa_tree* tree = NULL;
+	size_t bytes = 0;
+#define X(field) bytes += sizeof(*tree->field);
+	TERESA_TREE_ARRAYS(X)
+#undef X
+	return bytes;
 }
 
-static inline teresa_node tree_alloc(teresa_tree* tree) {
-	teresa_node node = tree->freeroot;
-	tree->freeroot = NODE_SIBLING(node);
-	return node;
+// Back nodes up to at least nd with memory, a chunk at a time
+static void teresa_tree_commit(teresa_tree* tree, teresa_node nd) {
+	pthread_mutex_lock(&tree->commit_lock);
+
+	uint32_t committed = tree->committed;
+	if (nd >= committed) {
+		uint64_t target = (uint64_t) committed + TERESA_COMMIT_CHUNK;
+		if (target <= nd) target = (uint64_t) nd + 1;
+		if (target > tree->capacity) target = tree->capacity;
+
+		int err = 0;
+#define X(field) err |= mprotect(tree->field, page_round(target * sizeof(*tree->field)), PROT_READ | PROT_WRITE);
+		TERESA_TREE_ARRAYS(X)
+#undef X
+		assert(!err);
+
+		__atomic_store_n(&tree->committed, (uint32_t) target, __ATOMIC_RELEASE);
+	}
+
+	pthread_mutex_unlock(&tree->commit_lock);
 }
 
-static inline teresa_node teresa_node_create(teresa_tree* tree) {
-	teresa_node node = tree_alloc(tree);
-	++teresa_node_count;
+// Lock-free pop from the free list of n-node blocks; every update bumps the counter in the high half,
+// so a stale head never matches
+static inline teresa_node freelist_pop(teresa_tree* tree, int n) {
+	uint64_t* freelist = &tree->freelist[n];
+	uint64_t head = __atomic_load_n(freelist, __ATOMIC_ACQUIRE);
+	teresa_node node;
+	do {
+		node = FREELIST_NODE(head);
+		if (!node) {
+			break;
+		}
+	} while (!__atomic_compare_exchange_n(freelist, &head, FREELIST_NEXT(head, NODE_CHILD(node)),
+		true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
 	return node;
 }
 
-static inline void tree_free(teresa_tree* tree, teresa_node nd) {
-	NODE_SIBLING(nd) = tree->freeroot;
-	tree->freeroot = nd;
+static inline void tree_free(teresa_tree* tree, teresa_node first, int n) {
+	uint64_t* freelist = &tree->freelist[n];
+	uint64_t head = __atomic_load_n(freelist, __ATOMIC_RELAXED);
+	do {
+		NODE_CHILD(first) = FREELIST_NODE(head);
+	} while (!__atomic_compare_exchange_n(freelist, &head, FREELIST_NEXT(head, first),
+		true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
 
-// Destroys a node's siblings and children
-static void teresa_node_destroy_recursive(teresa_tree* tree, teresa_node nd) {
-	if (NODE_CHILD(nd)) {
-		teresa_node_destroy_recursive(tree, NODE_CHILD(nd));
+// Released block of the same size first, else n fresh nodes above the high-water mark
+// Once there are none left, carves the block out of a bigger released one
+static inline teresa_node tree_alloc(teresa_tree* tree, int n) {
+	teresa_node node = freelist_pop(tree, n);
+	if (node) {
+		return node;
+	}
+
+	// Never past capacity, so failed attempts leave the mark alone
+	node = __atomic_load_n(&tree->high_water, __ATOMIC_RELAXED);
+	while ((uint64_t) node + n <= tree->capacity) {
+		if (__atomic_compare_exchange_n(&tree->high_water, &node, node + n,
+			true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			if (node + n > __atomic_load_n(&tree->committed, __ATOMIC_ACQUIRE)) {
+				teresa_tree_commit(tree, node + n - 1);
+			}
+			return node;
+		}
 	}
-	if (NODE_SIBLING(nd)) {
-		teresa_node_destroy_recursive(tree, NODE_SIBLING(nd));
+
+	for (int m = n + 1; m <= NMOVES; ++m) {
+		node = freelist_pop(tree, m);
+		if (node) {
+			tree_free(tree, node + n, m - n);
+			return node;
+		}
 	}
-	if (NODE_UNEXPLORED_COUNT(nd)) {
-		free(NODE_UNEXPLORED_MOVES(nd));
+	return NODE_NULL;
+}
+
+// First node of n consecutive ones, none of them initialized; NODE_NULL if the tree is full
+static inline teresa_node teresa_block_create(teresa_tree* tree, int n) {
+	teresa_node first = tree_alloc(tree, n);
+	if (!first) {
+		return NODE_NULL;
 	}
-	tree_free(tree, nd);
-	--teresa_node_count;
+	__atomic_fetch_add(&tree->used, n, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&tree->allocated, n, __ATOMIC_RELAXED);
+	return first;
+}
+
+// Gives a block back, without looking at what hangs below it
+static inline void teresa_block_release(teresa_tree* tree, teresa_node first, int n) {
+	tree_free(tree, first, n);
+	__atomic_fetch_sub(&tree->used, n, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&tree->released, n, __ATOMIC_RELAXED);
 }
 
-// Destroy a node and its children
-static inline void teresa_node_destroy(teresa_tree* tree, teresa_node nd) {
-	if (NODE_CHILD(nd)) {
-		teresa_node_destroy_recursive(tree, NODE_CHILD(nd));
+// Queue a block & the subtrees below it for release by teresa_tree_collect
+// Only called between searches, or by the collecting thread
+static void teresa_garbage_push(teresa_tree* tree, teresa_node first, int n) {
+	if (tree->ngarbage == tree->garbage_size) {
+		tree->garbage_size = tree->garbage_size ? 2 * tree->garbage_size : 64;
+		tree->garbage = realloc(tree->garbage, tree->garbage_size * sizeof(teresa_block));
+		assert(tree->garbage);
 	}
-	if (NODE_UNEXPLORED_COUNT(nd)) {
-		free(NODE_UNEXPLORED_MOVES(nd));
+	tree->garbage[tree->ngarbage] = (teresa_block) {.first = first, .n = n};
+	__atomic_store_n(&tree->ngarbage, tree->ngarbage + 1, __ATOMIC_RELAXED);
+}
+
+// Throw away the root & everything below it
+// Not thread-safe; only called between searches
+static void teresa_tree_discard_root(teresa_tree* tree) {
+	teresa_node root = tree->root;
+	if (NODE_NCHILDREN(root)) {
+		teresa_garbage_push(tree, NODE_CHILD(root), NODE_NCHILDREN(root));
 	}
-	tree_free(tree, nd);
-	--teresa_node_count;
+	teresa_block_release(tree, root, 1);
+	tree->root = NODE_NULL;
 }
 
-static inline teresa_node teresa_node_sibling(teresa_tree* tree, teresa_node nd, int idx) {
-	for (int i = 0; i < idx; ++i) {
-		nd = NODE_SIBLING(nd);
-		if (!nd) {
-			return NODE_NULL;
+// Release queued blocks until about n nodes are freed; children blocks of released nodes join the queue
+// Search threads call it as they go; whoever finds it busy just moves on
+static void teresa_tree_collect(teresa_tree* tree, uint32_t n) {
+	if (!__atomic_load_n(&tree->ngarbage, __ATOMIC_RELAXED)) return;
+	if (__atomic_exchange_n(&tree->collecting, true, __ATOMIC_ACQUIRE)) return;
+
+	while (tree->ngarbage && n) {
+		teresa_block block = tree->garbage[--tree->ngarbage];
+		for (int i = 0; i < block.n; ++i) {
+			teresa_node nd = block.first + i;
+			if (NODE_NCHILDREN(nd)) {
+				teresa_garbage_push(tree, NODE_CHILD(nd), NODE_NCHILDREN(nd));
+			}
 		}
+
+		teresa_block_release(tree, block.first, block.n);
+		n -= min_u32(n, block.n);
+	}
+
+	__atomic_store_n(&tree->collecting, false, __ATOMIC_RELEASE);
+}
+
+// Largest power of 2 of entries fitting in memory bytes; pages are only touched once used
+static void teresa_tt_init(teresa_tt* tt, size_t memory) {
+	size_t size = 1024;
+	while (size * 2 * sizeof(teresa_tt_entry) <= memory && size * 2 <= ((size_t) 1 << 31)) {
+		size *= 2;
+	}
+
+	tt->entries = calloc(size, sizeof(teresa_tt_entry));
+	assert(tt->entries);
+	tt->mask = size - 1;
+	tt->claimed = 0;
+	tt->generation = 0;
+	tt->lookups = 0;
+	tt->hits = 0;
+	tt->full = 0;
+	tt->inherited = 0;
+}
+
+// Forget every position, for a tree started over
+// Only while no search runs; counters are kept
+static void teresa_tt_clear(teresa_tree* tree) {
+	teresa_tt* tt = &tree->tt;
+	if (tt->claimed) {
+		memset(tt->entries, 0, ((size_t) tt->mask + 1) * sizeof(teresa_tt_entry));
+		tt->claimed = 0;
 	}
-	return nd;
 }
 
-// Initialize tree: empty decision tree, flat free tree
-static void teresa_tree_init(teresa_tree* tree) {
+// Initialize tree: empty decision tree, empty free lists, nothing committed yet
+// Reserves address space for as many nodes as fit in memory bytes, plus a transposition table of tt_memory bytes
+static void teresa_tree_init(teresa_tree* tree, size_t memory, size_t tt_memory) {
 	tree->root = NODE_NULL;
-	
-	teresa_node node;
+	memset(tree->freelist, 0, sizeof(tree->freelist));
+
+	uint64_t capacity = memory / teresa_node_bytes();
+	if (capacity < 2 * TERESA_NODE_RESERVE) capacity = 2 * TERESA_NODE_RESERVE;
+	if (capacity > UINT32_MAX) capacity = UINT32_MAX;
+	tree->capacity = capacity;
+
+	size_t size = 0;
+#define X(field) size += page_round(capacity * sizeof(*tree->field));
+	TERESA_TREE_ARRAYS(X)
+#undef X
+
+	void* base = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	assert(base != MAP_FAILED);
+	tree->reservation = base;
+	tree->reservation_size = size;
+
+	char* next = base;
+#define X(field) tree->field = (void*) next; next += page_round(capacity * sizeof(*tree->field));
+	TERESA_TREE_ARRAYS(X)
+#undef X
+
+	// Leave node 0 unitialized, so valgrind could catch anything accessing it
+	tree->high_water = 1;
+	tree->committed = 0;
+	tree->used = 0;
+	tree->allocated = 0;
+	tree->released = 0;
+	tree->garbage = NULL;
+	tree->ngarbage = 0;
+	tree->garbage_size = 0;
+	tree->collecting = false;
+	pthread_mutex_init(&tree->commit_lock, NULL);
+
+	teresa_tt_init(&tree->tt, tt_memory);
+}
+
+static inline void teresa_ownership_clear(teresa_ownership* own) {
+	memset(own->owner, 0, sizeof(own->owner));
+	own->score = 0;
+	own->playouts = 0;
+	own->key = 0;
+}
+
+// Plain loop over the board so the compiler can vectorize it
+// Playouts that failed (no winner) are left out
+static inline void teresa_ownership_add(teresa_ownership* own, playout_result* result) {
+	if (result->winner == EMPTY) return;
+
+	const color* owner = result->owner;
+	for (int i = 0; i < COUNT; ++i) {
+		own->owner[i] += (owner[i] == BLACK) - (owner[i] == WHITE);
+	}
+	own->score += result->score[BLACK] - result->score[WHITE];
+	++own->playouts;
+}
 
-	// Leave index 0 unitialized, so valgrind could catch anything accessing it
-	// Actually, each node should initialize itself
-	// memset(tree->parent + 1, NODE_NULL, sizeof(tree->parent[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->sibling + 1, NODE_NULL, sizeof(tree->sibling[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->child + 1, NODE_NULL, sizeof(tree->child[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->pwin + 1, NODE_NULL, sizeof(tree->pwin[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->sqlg_visits + 1, NODE_NULL, sizeof(tree->sqlg_visits[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->rsqrt_visits + 1, NODE_NULL, sizeof(tree->rsqrt_visits[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->wins + 1, NODE_NULL, sizeof(tree->wins[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->visits + 1, NODE_NULL, sizeof(tree->visits[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->mv + 1, NODE_NULL, sizeof(tree->mv[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->pl + 1, NODE_NULL, sizeof(tree->pl[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->unexplored_moves + 1, NODE_NULL, sizeof(tree->unexplored_moves[0]) * (TERESA_MAX_NODES - 1));
-	// memset(tree->unexplored_count + 1, NODE_NULL, sizeof(tree->unexplored_count[0]) * (TERESA_MAX_NODES - 1));
+static inline void teresa_ownership_merge(teresa_ownership* own, teresa_ownership* other) {
+	for (int i = 0; i < COUNT; ++i) {
+		own->owner[i] += other->owner[i];
+	}
+	own->score += other->score;
+	own->playouts += other->playouts;
+}
+
+// Tree with an empty root
+static teresa_tree* teresa_tree_create(size_t memory, size_t tt_memory) {
+	teresa_tree* tree = malloc(sizeof(teresa_tree));
+	assert(tree);
+	teresa_tree_init(tree, memory, tt_memory);
+
+	teresa_node root = teresa_block_create(tree, 1);
+	assert(root);
+	teresa_node_init(tree, root);
+	tree->root = root;
 
-	// Initialize free tree
-	tree->freeroot = 1;
-	for (node = 1; node < TERESA_MAX_NODES-2; ++node) {
-		NODE_SIBLING(node) = node+1;
+	return tree;
+}
+
+// Forget everything, keeping an empty root
+static void teresa_tree_clear(teresa_tree* tree) {
+	if (tree->root) {
+		teresa_tree_discard_root(tree);
 	}
-	NODE_SIBLING(TERESA_MAX_NODES-1) = NODE_NULL;
+	teresa_tt_clear(tree);
 
+	teresa_node root = teresa_block_create(tree, 1);
+	assert(root);
+	teresa_node_init(tree, root);
+	tree->root = root;
 }
 
 static void teresa_params_init(void* params) {
-	teresa_tree* tree = ((teresa_params*) params)->tree;
-	if (!tree) {
-		tree = malloc(sizeof(teresa_tree));
-		((teresa_params*) params)->tree = tree;
-		teresa_tree_init(tree);
+	teresa_tables_init();
+
+	if (!rng_is_seeded(&((teresa_params*) params)->rng)) {
+		rng_init(&((teresa_params*) params)->rng);
+		// Split off whether profiling or not, so -P leaves the search's draws alone
+		rng_split(&((teresa_params*) params)->rng, &((teresa_params*) params)->profile_rng);
+	}
+
+	if (!((teresa_params*) params)->ownership) {
+		teresa_ownership* own = malloc(sizeof(teresa_ownership));
+		assert(own);
+		teresa_ownership_clear(own);
+		((teresa_params*) params)->ownership = own;
+	}
+
+	if (!((teresa_params*) params)->trees) {
+		teresa_params* tp = params;
+		tp->ntrees = (tp->parallel == TERESA_ROOT_PARALLEL) ? max(tp->threads, 1) : 1;
+		tp->trees = malloc(tp->ntrees * sizeof(teresa_tree*));
+		assert(tp->trees);
+		size_t memory = tp->memory ? tp->memory : TERESA_DEFAULT_MEMORY;
+		size_t tt_memory = tp->tt_memory ? tp->tt_memory : TERESA_DEFAULT_TT_MEMORY;
+		for (int k = 0; k < tp->ntrees; ++k) {
+			tp->trees[k] = teresa_tree_create(memory / tp->ntrees, tt_memory / tp->ntrees);
+		}
+		tp->tree = tp->trees[0];
+	}
+}
+
+// Only one thread may expand a leaf; the others simulate from it until it has children
+static inline bool teresa_claim_expansion(teresa_tree* tree, teresa_node nd) {
+	uint8_t old = __atomic_fetch_or(&NODE_FLAGS(nd), TERESA_FLAG_EXPANDED, __ATOMIC_ACQUIRE);
+	return !(old & TERESA_FLAG_EXPANDED);
+}
 
-		teresa_node root = teresa_node_create(tree);
-		assert(root);
-		teresa_node_init(tree, root);
-		tree->root = root;
+// Cheap static strength of each move: pattern weights if any, times a few tactical & positional hints
+static void teresa_prior_gammas(state* st, pattern_table* patterns, move last, move* list, int n, float* gammas) {
+	static const int di[4] = {-1, 0, 0, 1};
+	static const int dj[4] = {0, -1, 1, 0};
+	color friendly = st->nextPlayer;
+
+	for (int k = 0; k < n; ++k) {
+		move mv = list[k];
+		if (mv < 0) {
+			gammas[k] = TERESA_PRIOR_PASS;
+			continue;
+		}
+
+		float gamma = patterns ? pattern_gamma(patterns, st, mv) : 1;
+		int i = mv / WIDTH;
+		int j = mv - i * WIDTH;
+
+		// Group freedoms count stone-liberty contacts, so a group with one is in atari for sure
+		bool capture = false;
+		bool escape = false;
+		bool atari = false;
+		for (int d = 0; d < 4; ++d) {
+			int ni = i + di[d];
+			int nj = j + dj[d];
+			if (ni < 0 || ni >= HEIGHT || nj < 0 || nj >= WIDTH) continue;
+
+			dot* stone = &st->board[ni*WIDTH + nj];
+			if (stone->player == EMPTY) continue;
+
+			int freedoms = stone->group->freedoms;
+			if (stone->player == friendly) {
+				escape |= (freedoms == 1);
+			} else {
+				capture |= (freedoms == 1);
+				atari |= (freedoms == 2);
+			}
+		}
+		if (capture) gamma *= TERESA_PRIOR_CAPTURE;
+		if (escape) gamma *= TERESA_PRIOR_ESCAPE;
+		if (atari) gamma *= TERESA_PRIOR_ATARI;
+
+		if (last >= 0) {
+			int li = last / WIDTH;
+			int lj = last - li * WIDTH;
+			if (abs(i - li) + abs(j - lj) <= 2) gamma *= TERESA_PRIOR_NEAR;
+		}
+
+		if (i == 0 || j == 0 || i == HEIGHT-1 || j == WIDTH-1) gamma *= TERESA_PRIOR_EDGE;
+
+		gammas[k] = gamma;
 	}
 }
 
-// Generate list of unexplored moves for a node, return number of moves
-static int teresa_generate_unexplored_moves(state* st, teresa_tree* tree, teresa_node nd) {
+// Give a claimed node one child per reasonable move, all in one block; return number of children
+// With priors on, children come best prior first (see teresa_width), priors scaled so the best one is 1
+// The block is fully written before being published, so concurrent readers only see finished nodes
+// Out of nodes, the node stays a leaf for good
+static int teresa_expand(state* st, teresa_tree* tree, teresa_node nd, teresa_params* params) {
 	move list[NMOVES];
 	int n = go_get_reasonable_moves(st, list);
+	assert(n);	// If not game over, there's gotta be a move we can play
 
-	move* unexplored_moves = malloc(n * sizeof(move));
-	assert(unexplored_moves);
+	teresa_node first = teresa_block_create(tree, n);
+	if (!first) {
+		return 0;
+	}
 
-	NODE_UNEXPLORED_COUNT(nd) = n;
-	NODE_UNEXPLORED_MOVES(nd) = unexplored_moves;	// BUG Check for leaked memory?
+	float gammas[NMOVES];
+	bool priors = params->bias > 0 || params->widen;
+	if (priors) {
+		teresa_prior_gammas(st, params->patterns, NODE_MV(nd), list, n, gammas);
+
+		// Insertion sort, keeping the order of equal moves
+		for (int i = 1; i < n; ++i) {
+			float gamma = gammas[i];
+			move mv = list[i];
+			int j = i;
+			for (; j > 0 && gammas[j-1] < gamma; --j) {
+				gammas[j] = gammas[j-1];
+				list[j] = list[j-1];
+			}
+			gammas[j] = gamma;
+			list[j] = mv;
+		}
+	}
 
 	for (int i = 0; i < n; ++i) {
-		unexplored_moves[i] = list[i];
+		teresa_node_init(tree, first + i);
+		NODE_PARENT(first + i) = nd;
+		NODE_MV(first + i) = list[i];
+		if (priors && gammas[0] > 0) {
+			NODE_AMAF(first + i) = AMAF(lrintf(gammas[i] / gammas[0] * TERESA_PRIOR_ONE), 0, 0);
+		}
 	}
 
+	NODE_NCHILDREN(nd) = n;
+	__atomic_store_n(&NODE_CHILD(nd), first, __ATOMIC_RELEASE);
+
 	return n;
 }
 
-// Assumes NODE_UNEXPLORED_COUNT(nd) >= 1
-static move teresa_extract_unexplored_move(teresa_tree* tree, teresa_node nd) {
-	const uint16_t count = NODE_UNEXPLORED_COUNT(nd);
+// Count a node as lost by whoever chose it (pl), until the playout through it comes back
+// Makes other threads prefer other branches in the meantime
+static inline void teresa_node_add_virtual_loss(teresa_tree* tree, teresa_node nd, color pl, color me, uint32_t vl) {
+	if (!vl) return;
+
+	__atomic_fetch_add(&NODE_STATS(nd), STATS((pl != me) ? vl : 0, vl), __ATOMIC_RELAXED);
+}
+
+#define TT_HASH(key) ((key) & 0x00FFFFFFFFFFFFFF)
+#define TT_GENERATION(key) ((uint8_t) ((key) >> 56))
+
+// Slot of a position, claiming a free one if it is new; 0 if there is no room
+// Positions found get the current generation; with no free slot in reach, the one looked up longest ago is taken
+// over if that was before the last move (a racing add may still land in it as it is reset; counts are approximate)
+static uint32_t teresa_tt_find(teresa_tt* tt, uint64_t hash, bool* known) {
+	__atomic_fetch_add(&tt->lookups, 1, __ATOMIC_RELAXED);
+
+	hash = TT_HASH(hash) ? TT_HASH(hash) : 1;
+	uint8_t generation = tt->generation;
+	uint64_t key = (uint64_t) generation << 56 | hash;
+
+	uint32_t stale = 0;
+	uint64_t stale_key = 0;
+	uint8_t stale_age = 0;
+	for (uint32_t p = 0; p < TERESA_TT_PROBES; ++p) {
+		uint32_t slot = (hash + p) & tt->mask;
+		uint64_t* at = &tt->entries[slot].key;
+		uint64_t k = __atomic_load_n(at, __ATOMIC_ACQUIRE);
+		while (true) {
+			if (!k) {
+				if (__atomic_compare_exchange_n(at, &k, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+					__atomic_fetch_add(&tt->claimed, 1, __ATOMIC_RELAXED);
+					*known = false;
+					return slot + 1;
+				}
+			} else if (TT_HASH(k) == hash) {
+				if (TT_GENERATION(k) == generation
+					|| __atomic_compare_exchange_n(at, &k, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+					*known = true;
+					return slot + 1;
+				}
+			} else {
+				break;
+			}
+		}
+
+		uint8_t age = generation - TT_GENERATION(k);
+		if (age > stale_age) {
+			stale = slot + 1;
+			stale_key = k;
+			stale_age = age;
+		}
+	}
+
+	if (stale && __atomic_compare_exchange_n(&tt->entries[stale - 1].key, &stale_key, key,
+		false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&tt->entries[stale - 1].wins, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&tt->entries[stale - 1].visits, 0, __ATOMIC_RELAXED);
+		*known = false;
+		return stale;
+	}
+
+	__atomic_fetch_add(&tt->full, 1, __ATOMIC_RELAXED);
+	return 0;
+}
 
-	int r = RANDI(0, count);
-	move mv = NODE_UNEXPLORED_MOVES(nd)[r];
+// Entry of the position st that walking into a node leads to (slot + 1, 0 if there's no room); nodes don't keep it,
+// so it is looked up on every walk
+// The first time a node is walked into, if the position was reached by another path before, the node starts off
+// with a share of what was learned there, scaled down to TERESA_TT_INHERIT playouts so it can't drown its siblings;
+// that share is kept in its flags, since it only counts for win rates, not among the visits moves are chosen by
+static uint32_t teresa_tt_link(teresa_tree* tree, teresa_node nd, state* st, color me) {
+	teresa_tt* tt = &tree->tt;
+	bool known;
+	uint32_t e = teresa_tt_find(tt, state_hash(st), &known);
+	if (!e || (__atomic_fetch_or(&NODE_FLAGS(nd), TERESA_FLAG_LINKED, __ATOMIC_RELAXED) & TERESA_FLAG_LINKED) || !known) {
+		return e;
+	}
 
-	// Swap with last element & shorten array
-	NODE_UNEXPLORED_MOVES(nd)[r] = NODE_UNEXPLORED_MOVES(nd)[count-1];
-	NODE_UNEXPLORED_COUNT(nd) = count - 1;
+	teresa_tt_entry* entry = &tt->entries[e - 1];
+	uint32_t visits = __atomic_load_n(&entry->visits, __ATOMIC_RELAXED);
+	uint32_t wins = min_u32(__atomic_load_n(&entry->wins, __ATOMIC_RELAXED), visits);
+	if (!visits) return e;
 
-	if (NODE_UNEXPLORED_COUNT(nd) <= 0) {
-		free(NODE_UNEXPLORED_MOVES(nd));
-		NODE_UNEXPLORED_MOVES(nd) = NODE_NULL;
+	if (visits > TERESA_TT_INHERIT) {
+		wins = (uint64_t) wins * TERESA_TT_INHERIT / visits;
+		visits = TERESA_TT_INHERIT;
+	}
+	if (st->nextPlayer == me) {
+		wins = visits - wins;	// Node was played by the opponent
 	}
 
-	return mv;
+	__atomic_fetch_add(&NODE_STATS(nd), STATS(wins, visits), __ATOMIC_RELAXED);
+	__atomic_fetch_or(&NODE_FLAGS(nd), visits << TERESA_FLAG_INHERITED_SHIFT, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&tt->hits, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&tt->inherited, visits, __ATOMIC_RELAXED);
+	return e;
 }
 
-// Creates a new child node for given move & inserts it correctly into tree
-static teresa_node teresa_node_create_child(teresa_tree* tree, teresa_node parent, move* mv) {
-	teresa_node child = teresa_node_create(tree);
-	assert(child);
+// Add results of the playouts from a leaf (played by pl, depth moves below the root) up to the root,
+// reverting virtual losses on the way
+// Entries of the positions along the path (path[d] for the node d + 1 moves deep, see teresa_tt_link)
+// get the same results, without the virtual losses
+static inline void teresa_backpropagate(teresa_tree* tree, teresa_node leaf, teresa_node root, const uint32_t* path, int depth, color pl, color me, uint32_t wins, uint32_t visits, uint32_t vl) {
+	teresa_node current = leaf;
+	do {
+		uint32_t e = (--depth >= 0 && depth < TERESA_PATH_MAX) ? path[depth] : 0;
+		if (e) {
+			teresa_tt_entry* entry = &tree->tt.entries[e - 1];
+			__atomic_fetch_add(&entry->visits, visits, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&entry->wins, (pl == me) ? wins : visits - wins, __ATOMIC_RELAXED);
+		}
+
+		// Both counts in one go; the virtual loss taken back is never more than what's there
+		int64_t loss = (current == root) ? 0 : vl;
+		int64_t dvisits = visits - loss;
+		int64_t dwins = wins - ((pl != me) ? loss : 0);
+		__atomic_fetch_add(&NODE_STATS(current), (uint64_t) (dvisits * ((int64_t) 1 << 32) + dwins), __ATOMIC_RELAXED);
+
+		pl = color_opponent(pl);
+		current = NODE_PARENT(current);
+	} while (current != NODE_NULL);
+}
 
-	teresa_node_init(tree, child);
+// MCTS-solver: whoever moved into nd wins (or loses) with best play; carry what that proves up to the root
+// A node is lost for its mover once any child is won, & won once all its children are lost
+// (all reasonable moves, that is: the ones go_get_reasonable_moves gave the tree)
+// Flags are only ever set, so a thread seeing a sibling's flag late merely misses a proof for now
+static void teresa_prove(teresa_tree* tree, teresa_node nd, teresa_node root, bool won) {
+	while (true) {
+		__atomic_fetch_or(&NODE_FLAGS(nd), won ? TERESA_FLAG_WON : TERESA_FLAG_LOST, __ATOMIC_RELAXED);
+		if (nd == root) return;
+
+		teresa_node parent = NODE_PARENT(nd);
+		if (!won) {
+			teresa_node first = NODE_CHILD(parent);
+			for (int i = 0; i < NODE_NCHILDREN(parent); ++i) {
+				if (!(__atomic_load_n(&NODE_FLAGS(first + i), __ATOMIC_RELAXED) & TERESA_FLAG_LOST)) {
+					return;
+				}
+			}
+		}
+		nd = parent;
+		won = !won;
+	}
+}
 
-	NODE_PARENT(child) = parent;
-	if (NODE_CHILD(parent)) {	// Insert into existing child list
-		NODE_SIBLING(child) = NODE_CHILD(parent);
-		NODE_CHILD(parent) = child;
-	} else {	// Currently only child
-		NODE_CHILD(parent) = child;
+// Points first played by each color in the playouts of a leaf: in how many playouts, & how many of those were won
+typedef struct {
+	uint32_t plays[3][COUNT];
+	uint32_t wins[3][COUNT];
+} teresa_amaf;
+
+static inline void teresa_amaf_record(teresa_amaf* amaf, playout_result* result, bool won) {
+	for (int i = 0; i < COUNT; ++i) {
+		color pl = result->first[i];
+		amaf->plays[pl][i] += 1;
+		amaf->wins[pl][i] += won;
 	}
-	NODE_PL(child) = color_opponent(NODE_PL(parent));
-	NODE_MV(child) = *mv;
+}
 
-	return child;
+static inline void teresa_amaf_merge(teresa_amaf* amaf, teresa_amaf* other) {
+	for (int i = 0; i < COUNT; ++i) {
+		for (color pl = BLACK; pl <= WHITE; ++pl) {
+			amaf->plays[pl][i] += other->plays[pl][i];
+			amaf->wins[pl][i] += other->wins[pl][i];
+		}
+	}
 }
 
-static teresa_node teresa_select_best_child(teresa_tree* tree, teresa_node current, teresa_params* params, bool friendly_turn, float lower_bound) {
-	const float C = params->C;
-	const float FPU = params->FPU;
+// Count AMAF playouts for a node; both counts are halved once visits get near the top of their 12 bits,
+// which keeps the win rate but lets the count lag (only matters while beta is still visible, i.e. never)
+// Big batches are scaled down, so adds racing the halving can't carry into the prior
+static inline void teresa_amaf_add(teresa_tree* tree, teresa_node nd, uint32_t wins, uint32_t visits) {
+	if (visits > TERESA_AMAF_HALVE / 8) {
+		wins = (uint64_t) wins * (TERESA_AMAF_HALVE / 8) / visits;
+		visits = TERESA_AMAF_HALVE / 8;
+	}
+	uint32_t old = __atomic_fetch_add(&NODE_AMAF(nd), AMAF(0, wins, visits), __ATOMIC_RELAXED);
+	if (AMAF_VISITS(old) + visits < TERESA_AMAF_HALVE) return;
 
-	const float k = (NODE_VISITS(current) == 0) ? 1.0 : C * node_sqlg_visits(tree, current);
+	uint32_t amaf = __atomic_load_n(&NODE_AMAF(nd), __ATOMIC_RELAXED);
+	while (AMAF_VISITS(amaf) >= TERESA_AMAF_HALVE
+		&& !__atomic_compare_exchange_n(&NODE_AMAF(nd), &amaf, AMAF(AMAF_PRIOR(amaf), AMAF_WINS(amaf) / 2, AMAF_VISITS(amaf) / 2),
+			true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
 
-	float UCBs[NMOVES];
+// All-moves-as-first: every sibling along the path whose move its player made first later in the simulation,
+// in the tree or in the playouts, gets the playouts' results as if it had been played itself
+// amaf holds the playouts part; the tree part is added to it on the way up
+// pl played the leaf; siblings along the path were all choices of the same player as the node on the path
+static void teresa_backpropagate_amaf(teresa_tree* tree, teresa_node leaf, teresa_node root, color pl, teresa_amaf* amaf, uint32_t wins, uint32_t visits) {
+	for (teresa_node current = leaf; current != root; current = NODE_PARENT(current), pl = color_opponent(pl)) {
+		move mv = NODE_MV(current);
+		if (mv >= 0) {
+			amaf->plays[pl][mv] = visits;
+			amaf->wins[pl][mv] = wins;
+			amaf->plays[color_opponent(pl)][mv] = 0;
+			amaf->wins[color_opponent(pl)][mv] = 0;
+		}
 
+		teresa_node parent = NODE_PARENT(current);
+		teresa_node first = NODE_CHILD(parent);
+		for (int i = 0; i < NODE_NCHILDREN(parent); ++i) {
+			move sibling_mv = NODE_MV(first + i);
+			if (sibling_mv < 0) continue;
+
+			if (amaf->plays[pl][sibling_mv]) {
+				teresa_amaf_add(tree, first + i, amaf->wins[pl][sibling_mv], amaf->plays[pl][sibling_mv]);
+			}
+		}
+	}
+}
+
+// UCBs of n consecutive children into UCBs; returns the highest
+// With RAVE, win rates are blended with AMAF ones, by beta = sqrt(rave / (3 visits + rave)) (see teresa_amaf_add)
+// Unvisited children get FPU, moved up or down by how far their AMAF win rate is from even
+// Either way, progressive bias adds bias * prior / (1 + visits)
+// Four children at a time with SSE2, rest one by one the same way
+static inline float teresa_block_ucbs(teresa_tree* tree, teresa_node first, int n, bool friendly_turn, float k, float FPU, float rave, float bias, float* UCBs) {
+	const uint64_t* stats = &NODE_STATS(first);
+	const uint32_t* amaf = &NODE_AMAF(first);
+	const float prior_scale = 1.0f / TERESA_PRIOR_ONE;
+
+	float max_UCB = -INFINITY;
 	int i = 0;
-	float max_UCB = lower_bound;
-	int nmax_UCB = 0;
-	teresa_node selected_child = NODE_NULL;
-	teresa_node child = NODE_CHILD(current);
-	while (child) {
-		if (NODE_VISITS(child)) {
-			if (friendly_turn) {
-				UCBs[i] = node_pwin(tree, child) + k * node_rsqrt_visits(tree, child);
-			} else {
-				UCBs[i] = 1 - node_pwin(tree, child) + k * node_rsqrt_visits(tree, child);
+
+#ifdef __SSE2__
+	const __m128 one = _mm_set1_ps(1);
+	const __m128 half = _mm_set1_ps(0.5);
+	const __m128 three = _mm_set1_ps(3);
+	const __m128 vk = _mm_set1_ps(k);
+	const __m128 vfpu = _mm_set1_ps(FPU);
+	const __m128 vrave = _mm_set1_ps(rave);
+	const __m128 vbias = _mm_set1_ps(bias);
+	const __m128 vprior_scale = _mm_set1_ps(prior_scale);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i low = _mm_set1_epi32(0xFFF);
+	const __m128i rave_on = _mm_set1_epi32((rave > 0) ? -1 : 0);
+	__m128 vmax = _mm_set1_ps(-INFINITY);
+	for (; i + 4 <= n; i += 4) {
+		// Wins are the low halves of the stats, visits the high ones
+		__m128 s01 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*) (stats + i)));
+		__m128 s23 = _mm_castsi128_ps(_mm_loadu_si128((const __m128i*) (stats + i + 2)));
+		__m128i iw = _mm_castps_si128(_mm_shuffle_ps(s01, s23, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i iv = _mm_castps_si128(_mm_shuffle_ps(s01, s23, _MM_SHUFFLE(3, 1, 3, 1)));
+		__m128i ia = _mm_loadu_si128((const __m128i*) (amaf + i));
+		__m128i iav = _mm_and_si128(_mm_srli_epi32(ia, 12), low);
+
+		__m128 v = _mm_cvtepi32_ps(iv);
+		__m128 pwin = _mm_div_ps(_mm_cvtepi32_ps(iw), v);
+		__m128 apwin = _mm_div_ps(_mm_cvtepi32_ps(_mm_and_si128(ia, low)), _mm_cvtepi32_ps(iav));
+		if (!friendly_turn) {
+			pwin = _mm_sub_ps(one, pwin);
+			apwin = _mm_sub_ps(one, apwin);
+		}
+
+		// Lanes without AMAF playouts computed garbage (0/0); masked out
+		__m128 has_amaf = _mm_castsi128_ps(_mm_andnot_si128(_mm_cmpeq_epi32(iav, zero), rave_on));
+		__m128 beta = _mm_sqrt_ps(_mm_div_ps(vrave, _mm_add_ps(_mm_mul_ps(three, v), vrave)));
+		__m128 value = _mm_add_ps(pwin, _mm_and_ps(has_amaf, _mm_mul_ps(beta, _mm_sub_ps(apwin, pwin))));
+		__m128 ucb = _mm_add_ps(value, _mm_mul_ps(vk, _mm_div_ps(one, _mm_sqrt_ps(v))));
+
+		// Same for unvisited lanes
+		__m128 unvisited = _mm_castsi128_ps(_mm_cmpeq_epi32(iv, zero));
+		__m128 fpu = _mm_add_ps(vfpu, _mm_and_ps(has_amaf, _mm_sub_ps(apwin, half)));
+		ucb = _mm_or_ps(_mm_and_ps(unvisited, fpu), _mm_andnot_ps(unvisited, ucb));
+
+		__m128 p = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(ia, 24)), vprior_scale);
+		__m128 pb = _mm_div_ps(_mm_mul_ps(vbias, p), _mm_add_ps(one, v));
+		ucb = _mm_add_ps(ucb, pb);
+
+		_mm_storeu_ps(UCBs + i, ucb);
+		vmax = _mm_max_ps(vmax, ucb);
+	}
+	vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+	vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+	max_UCB = _mm_cvtss_f32(vmax);
+#endif
+
+	for (; i < n; ++i) {
+		uint32_t v = stats[i] >> 32;
+		uint32_t av = AMAF_VISITS(amaf[i]);
+		bool has_amaf = rave > 0 && av;
+		float apwin = has_amaf ? (float) AMAF_WINS(amaf[i]) / av : 0;
+		if (!friendly_turn) {
+			apwin = 1 - apwin;
+		}
+
+		if (v) {
+			float pwin = (float) (uint32_t) stats[i] / v;
+			if (!friendly_turn) {
+				pwin = 1 - pwin;
 			}
+			float value = pwin + (has_amaf ? sqrtf(rave / (3 * (float) v + rave)) * (apwin - pwin) : 0);
+			UCBs[i] = value + k * rsqrt(v);
 		} else {
-			UCBs[i] = FPU;
+			UCBs[i] = FPU + (has_amaf ? apwin - 0.5f : 0);
+		}
+		UCBs[i] += bias * (AMAF_PRIOR(amaf[i]) * prior_scale) / (1 + (float) v);
+		if (UCBs[i] > max_UCB) {
+			max_UCB = UCBs[i];
 		}
+	}
 
-		// Count max values
+	return max_UCB;
+}
+
+// Children of a node open to selection under progressive widening, best priors first:
+// params->widen at first, one more at TERESA_WIDEN_VISITS visits & every time visits grow TERESA_WIDEN_RATE times more
+static inline int teresa_width(teresa_params* params, uint32_t visits, int n) {
+	if (!params->widen) {
+		return n;
+	}
+
+	int width = params->widen;
+	if (visits >= TERESA_WIDEN_VISITS) {
+		width += 1 + (int) (fast_log2((float) visits / TERESA_WIDEN_VISITS) / log2f(TERESA_WIDEN_RATE));
+	}
+	return min(width, n);
+}
+
+// Unvisited children count as FPU, so they get tried once the others look worse than that
+static teresa_node teresa_select_best_child(teresa_tree* tree, teresa_node current, teresa_params* params, bool friendly_turn, rng* r) {
+	teresa_node first = __atomic_load_n(&NODE_CHILD(current), __ATOMIC_ACQUIRE);
+	int n = teresa_width(params, NODE_VISITS(current), NODE_NCHILDREN(current));
+
+	const float k = (NODE_VISITS(current) == 0) ? 1.0 : params->C * sqlg(NODE_VISITS(current));
+
+	float UCBs[NMOVES];
+	float max_UCB = teresa_block_ucbs(tree, first, n, friendly_turn, k, params->FPU, params->rave, params->bias, UCBs);
+
+	// Proven children: a winning one is taken, losing ones are left out while anything else is open
+	bool pruned = false;
+	for (int i = 0; i < n; ++i) {
+		uint8_t flags = __atomic_load_n(&NODE_FLAGS(first + i), __ATOMIC_RELAXED);
+		if (flags & TERESA_FLAG_WON) {
+			return first + i;
+		}
+		if (flags & TERESA_FLAG_LOST) {
+			UCBs[i] = -INFINITY;
+			pruned = true;
+		}
+	}
+	if (pruned) {
+		max_UCB = -INFINITY;
+		for (int i = 0; i < n; ++i) {
+			max_UCB = fmaxf(max_UCB, UCBs[i]);
+		}
+	}
+
+	// Count max values
+	int nmax_UCB = 0;
+	int idx_max = 0;
+	for (int i = 0; i < n; ++i) {
 		if (UCBs[i] == max_UCB) {
 			++nmax_UCB;
-			selected_child = child;
-		} else if (UCBs[i] > max_UCB) {
-			max_UCB = UCBs[i];
-			nmax_UCB = 1;
-			selected_child = child;
+			idx_max = i;
 		}
-
-		++i;
-		child = NODE_SIBLING(child);
 	}
 
-	if (max_UCB == lower_bound && nmax_UCB == 0) {
-		// All children are below lower_bound
-		return NODE_NULL;
-	} else if (nmax_UCB == 1) {
-		// Found child
-		return selected_child;
-	} else {
+	if (nmax_UCB > 1) {
 		// Found many children with same UCB
-		int idx_max = pick_value_f(UCBs, i, max_UCB, nmax_UCB);
+		idx_max = pick_value_f(r, UCBs, n, max_UCB, nmax_UCB);
 		assert(idx_max != -1);
-		return teresa_node_sibling(tree, NODE_CHILD(current), idx_max);
 	}
+	return first + idx_max;
 }
 
-// Return most visited child (the one we're most certain of?)
-static teresa_node teresa_select_most_visited_child(teresa_tree* tree, teresa_node current) {
+// Index of the most visited of n children (the one we're most certain of?)
+// A proven win comes first whatever its visits, proven losses last; -1 if there are none
+static int teresa_pick_most_visited(const uint32_t* own_visits, const uint8_t* flags, int n, rng* r) {
 	float visits[NMOVES];	// float because pick_value_f only takes floats (overkill?)
 
-	int i = 0;
-	float max_visits = 0;
+	if (!n) {
+		return -1;
+	}
+
+	float max_visits = -2;	// Below proven losses, so any child beats it
 	int nmax = 0;
-	teresa_node selected_child = NODE_NULL;
-	teresa_node child = NODE_CHILD(current);
-	while (child) {
-		float visit = (float) NODE_VISITS(child);
+	int idx_max = 0;
+	for (int i = 0; i < n; ++i) {
+		if (flags[i] & TERESA_FLAG_WON) {
+			return i;
+		}
+		float visit = (flags[i] & TERESA_FLAG_LOST) ? -1 : (float) own_visits[i];
 		visits[i] = visit;
 
 		// Count max values
@@ -278,52 +931,161 @@ static teresa_node teresa_select_most_visited_child(teresa_tree* tree, teresa_no
 		} else if (visit > max_visits) {
 			max_visits = visit;
 			nmax = 1;
-			selected_child = child;
+			idx_max = i;
 		}
-
-		++i;
-		child = NODE_SIBLING(child);
 	}
 
-	if (nmax == 1) {
-		return selected_child;
-	} else {
-		int idx_max = pick_value_f(visits, i, max_visits, nmax);
+	if (nmax > 1) {
+		idx_max = pick_value_f(r, visits, n, max_visits, nmax);
 		assert(idx_max != -1);
-		return teresa_node_sibling(tree, NODE_CHILD(current), idx_max);
 	}
+	return idx_max;
+}
+
+// Return most visited child; NODE_NULL if current has no children
+static teresa_node teresa_select_most_visited_child(teresa_tree* tree, teresa_node current, rng* r) {
+	uint32_t visits[NMOVES];
+	uint8_t flags[NMOVES];
+
+	teresa_node first = NODE_CHILD(current);
+	int n = first ? NODE_NCHILDREN(current) : 0;
+	for (int i = 0; i < n; ++i) {
+		visits[i] = NODE_OWN_VISITS(first + i);
+		flags[i] = NODE_FLAGS(first + i);
+	}
+
+	int idx = teresa_pick_most_visited(visits, flags, n, r);
+	return idx < 0 ? NODE_NULL : first + idx;
+}
+
+// Checked once per run: proven losses never win over an unvisited open child, whatever their order
+static void teresa_pick_most_visited_check() {
+	static bool checked = false;
+	if (checked) return;
+
+	rng r;
+	rng_seed(&r, 1);
+	const uint8_t lost = TERESA_FLAG_LOST;
+
+	uint32_t visits[3] = {0, 0, 0};
+	uint8_t flags[3] = {lost, lost, 0};
+	assert(teresa_pick_most_visited(visits, flags, 3, &r) == 2);
+
+	uint8_t ties[3] = {lost, 0, 0};
+	for (int k = 0; k < 8; ++k) {
+		assert(teresa_pick_most_visited(visits, ties, 3, &r) != 0);
+	}
+
+	uint8_t all_lost[2] = {lost, lost};
+	assert(teresa_pick_most_visited(visits, all_lost, 2, &r) >= 0);
+
+	checked = true;
 }
 
 static void teresa_print_heatmap(state* st, teresa_tree* tree, teresa_node nd) {
 	double values[NMOVES];
 	move mvs[NMOVES];
 
-	int i = 0;
-	teresa_node child = NODE_CHILD(nd);
-	while (child) {
-		values[i] = node_pwin(tree, child);
-		mvs[i] = NODE_MV(child);
+	int n = 0;
+	teresa_node first = NODE_CHILD(nd);
+	for (int i = 0; i < NODE_NCHILDREN(nd); ++i) {
+		if (NODE_VISITS(first + i)) {
+			values[n] = node_pwin(tree, first + i);
+			mvs[n] = NODE_MV(first + i);
+			++n;
+		}
+	}
+
+	go_print_heatmap(st, mvs, values, n);
+}
+
+// Child of nd reached by mv, or NODE_NULL
+static teresa_node teresa_find_child(teresa_tree* tree, teresa_node nd, move mv) {
+	teresa_node first = NODE_CHILD(nd);
+	for (int i = 0; i < NODE_NCHILDREN(nd); ++i) {
+		if (NODE_MV(first + i) == mv) {
+			return first + i;
+		}
+	}
+	return NODE_NULL;
+}
+
+// Make the child reached by mv the new root, or start over if there is no such child
+// The child is copied into a block of its own, so the rest of its block can go with the old root
+static void teresa_tree_advance(teresa_tree* tree, move mv) {
+	teresa_node root = tree->root;
+	teresa_node child = root ? teresa_find_child(tree, root, mv) : NODE_NULL;
+	if (!child) {
+		teresa_tree_clear(tree);
+		return;
+	}
+
+	teresa_node kept = teresa_block_create(tree, 1);
+	assert(kept);
+#define X(field) tree->field[kept] = tree->field[child];
+	TERESA_TREE_ARRAYS(X)
+#undef X
+	NODE_PARENT(kept) = NODE_NULL;
 
-		++i;
-		child = NODE_SIBLING(child);
+	teresa_node first = NODE_CHILD(kept);
+	for (int i = 0; i < NODE_NCHILDREN(kept); ++i) {
+		NODE_PARENT(first + i) = kept;
 	}
 
-	go_print_heatmap(st, mvs, values, i);
+	// Subtree now hangs from the copy only
+	NODE_CHILD(child) = NODE_NULL;
+	NODE_NCHILDREN(child) = 0;
+
+	teresa_tree_discard_root(tree);
+	tree->root = kept;
+	tree->tt.generation++;
 }
 
-static void teresa_destroy_all_children_except_one(teresa_tree* tree, teresa_node parent, teresa_node keep) {
-	teresa_node next;
-	teresa_node current = NODE_CHILD(parent);
-	do {
-		next = NODE_SIBLING(current);
-		if (current == keep) {
-			NODE_SIBLING(current) = NODE_NULL;
-			NODE_PARENT(current) = NODE_NULL;
-		} else {
-			teresa_node_destroy(tree, current);
+// Root children of the first tree with the playouts of every tree summed up, to choose a move from
+// Kept out of the trees, so that no node carries visits its own subtree never saw
+typedef struct {
+	int n;
+	teresa_node node[NMOVES];	// In the first tree
+	uint32_t wins[NMOVES];		// Of own visits, for whoever moved into the child
+	uint32_t visits[NMOVES];	// Own visits, inherited ones left out
+	uint8_t flags[NMOVES];		// Proven in any tree
+} teresa_root_counts;
+
+// Sum the root children of every tree, as found in the first one
+// All roots were expanded from the same position, so they have the same children
+static void teresa_count_root(teresa_params* params, teresa_root_counts* counts) {
+	teresa_tree* tree = params->tree;
+	teresa_node root = tree->root;
+	teresa_node first = NODE_CHILD(root);
+
+	int by_move[NMOVES];	// Indexed by move + 1, so passes fit
+	for (int i = 0; i < NMOVES; ++i) {
+		by_move[i] = -1;
+	}
+	counts->n = first ? NODE_NCHILDREN(root) : 0;
+	for (int i = 0; i < counts->n; ++i) {
+		counts->node[i] = first + i;
+		counts->wins[i] = counts->visits[i] = 0;
+		counts->flags[i] = 0;
+		by_move[NODE_MV(first + i) + 1] = i;
+	}
+
+	for (int k = 0; k < params->ntrees; ++k) {
+		tree = params->trees[k];
+		root = tree->root;
+		first = NODE_CHILD(root);
+		int n = first ? NODE_NCHILDREN(root) : 0;
+		for (int i = 0; i < n; ++i) {
+			teresa_node child = first + i;
+			int j = by_move[NODE_MV(child) + 1];
+			if (j < 0) continue;
+
+			uint32_t own = NODE_OWN_VISITS(child);
+			counts->wins[j] += NODE_VISITS(child) ? (uint64_t) NODE_WINS(child) * own / NODE_VISITS(child) : 0;
+			counts->visits[j] += own;
+			counts->flags[j] |= NODE_FLAGS(child) & TERESA_FLAG_PROVEN;
 		}
-		current = next;
-	} while (current);
+	}
 }
 
 #define PARAM_C 0.5
@@ -334,11 +1096,12 @@ void pshort(teresa_tree* tree, teresa_node nd) {
 	wprintf(L"{");
 	
 	if (nd) {
-		move_print(&NODE_MV(nd));
+		move mv = NODE_MV(nd);
+		move_print(&mv);
 
 		float k = 1;
 		if (NODE_PARENT(nd) && NODE_VISITS(NODE_PARENT(nd)) != 0) {
-			k = PARAM_C * node_sqlg_visits(tree, NODE_PARENT(nd));
+			k = PARAM_C * sqlg(NODE_VISITS(NODE_PARENT(nd)));
 		}
 		wprintf(L", %d/%d; %.3f, %.3f", NODE_WINS(nd), NODE_VISITS(nd),
 			((double)NODE_WINS(nd)/NODE_VISITS(nd)) + k / sqrt(NODE_VISITS(nd)), 1 - ((double)NODE_WINS(nd)/NODE_VISITS(nd)) + k / sqrt(NODE_VISITS(nd)));
@@ -355,11 +1118,12 @@ void p(teresa_tree* tree, teresa_node nd) {
 	pshort(tree, nd);
 	
 	wprintf(L"\n  siblings:");
-	teresa_node current = nd;
-	while (NODE_SIBLING(current)) {
-		wprintf(L"\n    ");
-		pshort(tree, NODE_SIBLING(current));
-		current = NODE_SIBLING(current);
+	teresa_node parent = NODE_PARENT(nd);
+	for (int i = 0; parent && i < NODE_NCHILDREN(parent); ++i) {
+		if (NODE_CHILD(parent) + i != nd) {
+			wprintf(L"\n    ");
+			pshort(tree, NODE_CHILD(parent) + i);
+		}
 	}
 	
 	wprintf(L"\n  child:\n    ");
@@ -372,37 +1136,35 @@ static int int_desc_cmp(const void* a, const void* b) {
 	return *((int*)b) - *((int*)a);
 }
 
-static void graph_tree(FILE* f, teresa_tree* tree, teresa_node nd, int depth, int cutoff) {
+// pl played nd (NEUTRAL if unknown)
+static void graph_tree(FILE* f, teresa_tree* tree, teresa_node nd, color pl, int depth, int cutoff) {
 	if (!nd) return;
 	
 	wchar_t mv_str[3];
-	move_sprint(mv_str, &NODE_MV(nd));
+	move mv = NODE_MV(nd);
+	move_sprint(mv_str, &mv);
 
-	color pl = NODE_PL(nd);
 	char color_c = (pl == BLACK) ? 'b' : (pl == WHITE ? 'w' : 'n');
 
 	fprintf(f, "{\"id\":\"%x\",\"player\":\"%c\",\"move\":\"%ls\",\"visits\":%d,\"wins\":%d", nd, color_c, mv_str, NODE_VISITS(nd), NODE_WINS(nd));
 
 	if (depth > 0 && NODE_CHILD(nd)) {
 		--depth;
-		teresa_node child;
+		teresa_node first = NODE_CHILD(nd);
+		int n = NODE_NCHILDREN(nd);
 
 		// Find highest visits first
 		int node_visits[NMOVES];
-		int i = 0;
-		child = NODE_CHILD(nd);
-		while (child) {
-			node_visits[i] = NODE_VISITS(child);
-			++i;
-			child = NODE_SIBLING(child);
-		}
-		qsort(node_visits, i, sizeof(int), int_desc_cmp);
-		unsigned int thresh = max(node_visits[min(cutoff, i)-1], 40);
+		for (int i = 0; i < n; ++i) {
+			node_visits[i] = NODE_VISITS(first + i);
+		}
+		qsort(node_visits, n, sizeof(int), int_desc_cmp);
+		unsigned int thresh = max(node_visits[min(cutoff, n)-1], 40);
 		
-		if (i) {
-			child = NODE_CHILD(nd);
+		if (n) {
 			bool nothing_printed = true;
-			while (child) {
+			for (int i = 0; i < n; ++i) {
+				teresa_node child = first + i;
 				if (NODE_VISITS(child) >= thresh) {
 					if (nothing_printed) {
 						fprintf(f, ",\"children\":[\n");
@@ -410,9 +1172,8 @@ static void graph_tree(FILE* f, teresa_tree* tree, teresa_node nd, int depth, in
 					} else {
 						fprintf(f, ",\n");
 					}
-					graph_tree(f, tree, child, depth, cutoff);
+					graph_tree(f, tree, child, color_opponent(pl), depth, cutoff);
 				}
-				child = NODE_SIBLING(child);
 			}
 			if (!nothing_printed) {
 				fprintf(f, "]");
@@ -437,95 +1198,663 @@ void g2(teresa_tree* tree, teresa_node root, const char* path, int depth, int th
 	const char fmode = 'w';
 	
 	FILE* f = fopen(path, &fmode);
-	graph_tree(f, tree, root, depth, thresh);
+	graph_tree(f, tree, root, NEUTRAL, depth, thresh);
 	
 	fclose(f);
 }
 
-// params.N, params.C must be defined
-move_result teresa_play(player* self, state* st0, move* mv) {
-	color me = st0->nextPlayer;
-	color notme = (me == BLACK) ? WHITE : BLACK;
-
-	teresa_params_init(self->params);
-	teresa_params* params = (teresa_params*) self->params;
-
-	int N = params->N;
-	float FPU = params->FPU;
-	teresa_tree* tree = params->tree;
-	teresa_node root = tree->root;
-	NODE_PL(root) = notme;	// Root node is "what was just played", i.e. by opponent
-	
+// What one thread searches; threads of a tree-parallel search all point to the same tree
+typedef struct {
+	teresa_params* params;
+	teresa_tree* tree;
+	teresa_node root;
+	state* st0;
+	color me;
+	int N;
+	uint32_t virtual_loss;
+	int batch;				// Playouts per leaf
+	struct teresa_budget* budget;
+} teresa_search;
+
+// Shared by all threads of a search
+typedef struct teresa_budget {
+	int iterations;			// Playouts started by all threads, handed out atomically
+	int N;					// Most playouts the search may start
+	bool stop;				// Raised by the first thread that sees time is up or the choice made
+	bool open_ended;		// Pondering, only stopped from outside
+	uint64_t start;			// In timer ticks, set along with the deadlines
+	uint64_t soft_deadline;	// In timer ticks; 0 to run N playouts
+	uint64_t hard_deadline;
+} teresa_budget;
+
+// Helper threads of a leaf-parallel search, sharing the playouts of one leaf at a time
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned int generation;	// Bumped for each leaf
+	bool quit;
+	int helpers;
+	int busy;					// Helpers still working on current leaf
+	color me;
+	state* leaf;
+	int playouts;
+	int next;					// Next playout to hand out (atomic)
+	uint32_t wins;				// Atomic
+	teresa_amaf* amaf;			// Summed under the lock by every thread, or NULL
+} teresa_pool;
+
+// Private to one thread
+typedef struct {
+	teresa_search search;
+	teresa_pool* pool;		// Where to send playouts in leaf-parallel mode, else NULL
+	rng rng;
+	teresa_ownership ownership;
+	teresa_profile* profile;	// Phase timings of this thread, or NULL when not profiling
+	pthread_t thread;
+} teresa_worker;
+
+// Run playouts of the current leaf until there are none left, adding up wins (& AMAF counts) in the pool
+static void teresa_pool_work(teresa_pool* pool, teresa_worker* worker) {
 	state st;
-	int t;
-	for (t = 0; t < N; ++t) {
-		teresa_node current = root;
-		teresa_node child = NODE_NULL;
-		state_copy(st0, &st);
-
-		// Recurse into tree (think of next moves from what you played before)
-		while (NODE_CHILD(current)) {
-			if (NODE_UNEXPLORED_COUNT(current)) {
-				child = teresa_select_best_child(tree, current, params, st.nextPlayer == me, FPU);
-				if (!child) {
-					move mv = teresa_extract_unexplored_move(tree, current);
-					child = teresa_node_create_child(tree, current, &mv);
-				}
-			} else {
-				child = teresa_select_best_child(tree, current, params, st.nextPlayer == me, -INFINITY);
-			}
-			current = child;
-			go_play_move(&st, &NODE_MV(current));
-		}
-
+	uint32_t wins = 0;
+	teresa_amaf amaf;
+	if (pool->amaf) {
+		memset(&amaf, 0, sizeof(amaf));
+	}
+	while (__atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) < pool->playouts) {
 		playout_result result;
+		state_copy(pool->leaf, &st);
+		go_play_out(&st, &result, &worker->rng);
+		teresa_ownership_add(&worker->ownership, &result);
+		wins += (result.winner == pool->me);
+		if (pool->amaf) {
+			teresa_amaf_record(&amaf, &result, result.winner == pool->me);
+		}
+	}
+	__atomic_fetch_add(&pool->wins, wins, __ATOMIC_RELAXED);
 
-		// Estimate result of node, expanding & playing thru if necessary
-		if (go_is_game_over(&st)) {
-			
-			// Leaf node; don't expand, just find out who won
-			result.winner = state_winner(&st);
+	if (pool->amaf) {
+		pthread_mutex_lock(&pool->lock);
+		teresa_amaf_merge(pool->amaf, &amaf);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
 
-		} else {
+static void* teresa_helper_main(void* arg) {
+	teresa_worker* worker = arg;
+	teresa_pool* pool = worker->pool;
+	unsigned int seen = 0;
 
-			// Expansion (find things you never thought of before)
-			int n = teresa_generate_unexplored_moves(&st, tree, current);
-			assert(n);	// If not game over, there's gotta be a move we can play
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (pool->generation == seen && !pool->quit) {
+			pthread_cond_wait(&pool->start, &pool->lock);
+		}
+		if (pool->quit) break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
 
-			move mv = teresa_extract_unexplored_move(tree, current);
-			current = teresa_node_create_child(tree, current, &mv);
+		teresa_pool_work(pool, worker);
 
-			// Simulation (guessing what happens if you do certain things)
-			go_play_move(&st, &NODE_MV(current));
-			go_play_out(&st, &result);
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->busy == 0) {
+			pthread_cond_signal(&pool->done);
 		}
+	}
+	pthread_mutex_unlock(&pool->lock);
 
-		// Back-propagation (remember what's learned)
-		do {
-			++NODE_VISITS(current);
-			if (result.winner == me) {
-				++NODE_WINS(current);
-			}
-			NODE_PWIN(current) = NAN;
-			NODE_SQLG_VISITS(current) = NAN;
-			NODE_RSQRT_VISITS(current) = NAN;
+	return NULL;
+}
 
-			current = NODE_PARENT(current);
-		} while (current != NODE_NULL);
-	}
+static void teresa_pool_init(teresa_pool* pool, int helpers, color me) {
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	pool->generation = 0;
+	pool->quit = false;
+	pool->helpers = helpers;
+	pool->busy = 0;
+	pool->me = me;
+}
 
-	// Select most visited move (done thinking through all courses of action)
-	teresa_node best_node = teresa_select_most_visited_child(tree, root);
-	move best = NODE_MV(best_node);
+// Helpers must have been joined
+static void teresa_pool_destroy(teresa_pool* pool) {
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->lock);
+}
 
-	if (TERESA_DEBUG) {
+static void teresa_pool_stop(teresa_pool* pool) {
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+// Play out a leaf n times with the helpers' help; return wins
+static uint32_t teresa_pool_run(teresa_pool* pool, teresa_worker* worker, state* leaf, int n, teresa_amaf* amaf) {
+	pthread_mutex_lock(&pool->lock);
+	pool->leaf = leaf;
+	pool->playouts = n;
+	pool->next = 0;
+	pool->wins = 0;
+	pool->amaf = amaf;
+	pool->busy = pool->helpers;
+	++pool->generation;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	teresa_pool_work(pool, worker);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->busy) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return pool->wins;
+}
+
+// Play out a leaf n times; return wins
+// Fills amaf with what was played if given
+static uint32_t teresa_simulate(teresa_worker* worker, state* leaf, int n, teresa_amaf* amaf) {
+	if (amaf) {
+		memset(amaf, 0, sizeof(teresa_amaf));
+	}
+
+	if (worker->pool) {
+		return teresa_pool_run(worker->pool, worker, leaf, n, amaf);
+	}
+
+	color me = worker->search.me;
+	uint32_t wins = 0;
+	state st;
+	for (int i = 0; i < n; ++i) {
+		playout_result result;
+		state_copy(leaf, &st);
+		go_play_out(&st, &result, &worker->rng);
+		teresa_ownership_add(&worker->ownership, &result);
+		wins += (result.winner == me);
+		if (amaf) {
+			teresa_amaf_record(amaf, &result, result.winner == me);
+		}
+	}
+	return wins;
+}
+
+// Node pool nearly full, past the hard deadline, the root proven, or the choice is made:
+// - the runner-up can't catch up with the leader even if it got every playout left
+// - with params->confidence set, the leader's win rate is that many standard errors above the runner-up's
+// - past the soft deadline, the leader is clearly ahead
+static bool teresa_should_stop(teresa_tree* tree, teresa_node root, teresa_params* params, teresa_budget* budget) {
+	if (__atomic_load_n(&tree->used, __ATOMIC_RELAXED) + TERESA_NODE_RESERVE >= tree->capacity) {
+		return true;
+	}
+
+	// Nothing left to learn once the outcome is proven
+	if (__atomic_load_n(&NODE_FLAGS(root), __ATOMIC_RELAXED) & TERESA_FLAG_PROVEN) {
+		return true;
+	}
+
+	uint64_t now = budget->soft_deadline ? timer_ticks() : 0;
+	if (budget->soft_deadline && now >= budget->hard_deadline) {
+		return true;
+	}
+
+	teresa_node first = __atomic_load_n(&NODE_CHILD(root), __ATOMIC_ACQUIRE);
+	int n = first ? NODE_NCHILDREN(root) : 0;
+	teresa_node best = NODE_NULL;
+	teresa_node second = NODE_NULL;
+	for (int i = 0; i < n; ++i) {
+		teresa_node child = first + i;
+		if (!best || NODE_OWN_VISITS(child) > NODE_OWN_VISITS(best)) {
+			second = best;
+			best = child;
+		} else if (!second || NODE_OWN_VISITS(child) > NODE_OWN_VISITS(second)) {
+			second = child;
+		}
+	}
+	if (!second || budget->open_ended) {
+		return budget->soft_deadline && now >= budget->soft_deadline;
+	}
+
+	uint32_t best_visits = NODE_OWN_VISITS(best);
+	uint32_t second_visits = NODE_OWN_VISITS(second);
+
+	// Playouts left: the rest of N, or on the clock, as many as the pace so far fits before the hard deadline
+	int iterations = __atomic_load_n(&budget->iterations, __ATOMIC_RELAXED);
+	double remaining = budget->N - iterations;
+	if (budget->soft_deadline && now > budget->start) {
+		remaining = (double) iterations * (budget->hard_deadline - now) / (now - budget->start);
+	}
+	if (best_visits - second_visits > remaining) {
+		return true;
+	}
+
+	if (params->confidence > 0 && second_visits >= TERESA_CONFIDENCE_VISITS) {
+		double p1 = (double) NODE_WINS(best) / best_visits;
+		double p2 = (double) NODE_WINS(second) / second_visits;
+		double se = sqrt(p1 * (1 - p1) / best_visits + p2 * (1 - p2) / second_visits);
+		if (p1 - p2 > params->confidence * se) {
+			return true;
+		}
+	}
+
+	return budget->soft_deadline && now >= budget->soft_deadline && best_visits >= TERESA_EXTEND_RATIO * second_visits;
+}
+
+// Reservoir sampling: keeps sample number seen with probability TERESA_PROFILE_SAMPLES / (seen + 1)
+static void teresa_profile_keep(teresa_profile* profile, uint64_t seen, const uint64_t* ticks) {
+	uint64_t k = seen;
+	if (k >= TERESA_PROFILE_SAMPLES) {
+		k = ((xorshift128plus(&profile->rng) >> 32) * (k + 1)) >> 32;
+		if (k >= TERESA_PROFILE_SAMPLES) return;
+	}
+	for (int p = 0; p < TERESA_PHASES; ++p) {
+		profile->ticks[k][p] = (ticks[p] > UINT32_MAX) ? UINT32_MAX : ticks[p];
+	}
+}
+
+static void teresa_profile_add(teresa_profile* profile, const uint64_t* ticks) {
+	teresa_profile_keep(profile, profile->samples, ticks);
+	for (int p = 0; p < TERESA_PHASES; ++p) {
+		profile->total[p] += ticks[p];
+	}
+	++profile->samples;
+}
+
+// Samples kept by other stand for all it took, spread evenly
+static void teresa_profile_merge(teresa_profile* profile, teresa_profile* other) {
+	uint64_t kept = (other->samples < TERESA_PROFILE_SAMPLES) ? other->samples : TERESA_PROFILE_SAMPLES;
+	for (uint64_t k = 0; k < kept; ++k) {
+		uint64_t ticks[TERESA_PHASES];
+		for (int p = 0; p < TERESA_PHASES; ++p) {
+			ticks[p] = other->ticks[k][p];
+		}
+		teresa_profile_keep(profile, profile->samples + k * other->samples / kept, ticks);
+	}
+	for (int p = 0; p < TERESA_PHASES; ++p) {
+		profile->total[p] += other->total[p];
+	}
+	profile->samples += other->samples;
+	profile->iterations += other->iterations;
+}
+
+// Timestamp the end of a phase of a sampled iteration
+#define TERESA_PROFILE_MARK(phase) do { if (sampled) stamps[(phase) + 1] = timer_ticks(); } while (0)
+
+static void teresa_search_run(teresa_worker* worker) {
+	teresa_search* search = &worker->search;
+	teresa_params* params = search->params;
+	teresa_tree* tree = search->tree;
+	teresa_node root = search->root;
+	color me = search->me;
+	uint32_t vl = search->virtual_loss;
+	int batch = search->batch;
+	teresa_budget* budget = search->budget;
+	bool rave = params->rave > 0;
+	rng* r = &worker->rng;
+
+	teresa_profile* profile = worker->profile;
+	uint64_t stamps[TERESA_PHASES + 1] = {0};
+	int since_sample = 0;
+
+	state st;
+	teresa_amaf amaf;
+	uint32_t path[TERESA_PATH_MAX];
+	int since_check = 0;
+	while (!__atomic_load_n(&budget->stop, __ATOMIC_RELAXED)
+		&& __atomic_fetch_add(&budget->iterations, batch, __ATOMIC_RELAXED) < search->N) {
+
+		bool sampled = false;
+		if (profile) {
+			++profile->iterations;
+			if (++since_sample >= params->profile) {
+				since_sample = 0;
+				sampled = true;
+				stamps[0] = timer_ticks();
+			}
+		}
+
+		// Free what previous moves threw away, a bit at a time
+		teresa_tree_collect(tree, TERESA_COLLECT_BATCH);
+
+		if ((since_check += batch) >= TERESA_CHECK_INTERVAL) {
+			since_check = 0;
+			if (teresa_should_stop(tree, root, params, budget)) {
+				__atomic_store_n(&budget->stop, true, __ATOMIC_RELAXED);
+				break;
+			}
+		}
+		TERESA_PROFILE_MARK(TERESA_PHASE_UPKEEP);
+
+		teresa_node current = root;
+		int depth = 0;
+		state_copy(search->st0, &st);
+		TERESA_PROFILE_MARK(TERESA_PHASE_COPY);
+
+		// Recurse into tree (think of next moves from what you played before), down to a proven node at most
+		while (__atomic_load_n(&NODE_CHILD(current), __ATOMIC_ACQUIRE)
+			&& !(__atomic_load_n(&NODE_FLAGS(current), __ATOMIC_RELAXED) & TERESA_FLAG_PROVEN)) {
+			current = teresa_select_best_child(tree, current, params, st.nextPlayer == me, r);
+			teresa_node_add_virtual_loss(tree, current, st.nextPlayer, me, vl);
+			move mv = NODE_MV(current);
+			go_play_move(&st, &mv);
+			uint32_t e = teresa_tt_link(tree, current, &st, me);
+			if (depth < TERESA_PATH_MAX) path[depth] = e;
+			++depth;
+		}
+		TERESA_PROFILE_MARK(TERESA_PHASE_DESCENT);
+
+		uint32_t wins;
+		uint32_t visits;
+
+		// Estimate result of node, expanding & playing thru if necessary
+		uint8_t proven = __atomic_load_n(&NODE_FLAGS(current), __ATOMIC_RELAXED) & TERESA_FLAG_PROVEN;
+		if (proven) {
+
+			// Result already known; count it once more so the path keeps its weight
+			TERESA_PROFILE_MARK(TERESA_PHASE_EXPANSION);
+			bool mover_wins = proven & TERESA_FLAG_WON;
+			wins = (mover_wins == (st.nextPlayer != me));
+			visits = 1;
+			if (rave) {
+				memset(&amaf, 0, sizeof(amaf));
+			}
+			TERESA_PROFILE_MARK(TERESA_PHASE_PLAYOUT);
+
+		} else if (go_is_game_over(&st)) {
+			
+			// Leaf node; don't expand, just find out who won & remember it for good
+			TERESA_PROFILE_MARK(TERESA_PHASE_EXPANSION);
+			playout_result result;
+			go_get_result(&st, &result);
+			teresa_ownership_add(&worker->ownership, &result);
+			wins = (result.winner == me);
+			visits = 1;
+			if (rave) {
+				memset(&amaf, 0, sizeof(amaf));
+			}
+			if (result.winner == BLACK || result.winner == WHITE) {
+				teresa_prove(tree, current, root, result.winner != st.nextPlayer);
+			}
+			TERESA_PROFILE_MARK(TERESA_PHASE_PLAYOUT);
+
+		} else {
+
+			// Expansion (find things you never thought of before), once the leaf looks worth its block
+			// If another thread is already expanding this leaf, simulate from the leaf itself
+			if ((current == root || NODE_VISITS(current) >= TERESA_EXPAND_VISITS)
+				&& teresa_claim_expansion(tree, current) && teresa_expand(&st, tree, current, params)) {
+
+				// All children are at FPU, so this picks one at random
+				current = teresa_select_best_child(tree, current, params, st.nextPlayer == me, r);
+				teresa_node_add_virtual_loss(tree, current, st.nextPlayer, me, vl);
+				move mv = NODE_MV(current);
+				go_play_move(&st, &mv);
+				uint32_t e = teresa_tt_link(tree, current, &st, me);
+				if (depth < TERESA_PATH_MAX) path[depth] = e;
+				++depth;
+			}
+			TERESA_PROFILE_MARK(TERESA_PHASE_EXPANSION);
+
+			// Simulation (guessing what happens if you do certain things)
+			wins = teresa_simulate(worker, &st, batch, rave ? &amaf : NULL);
+			visits = batch;
+			TERESA_PROFILE_MARK(TERESA_PHASE_PLAYOUT);
+		}
+
+		// Back-propagation (remember what's learned), all playouts of the leaf at once
+		// The leaf was played by whoever isn't to play in st; players alternate from there up
+		color pl = color_opponent(st.nextPlayer);
+		teresa_backpropagate(tree, current, root, path, depth, pl, me, wins, visits, vl);
+		if (rave) {
+			teresa_backpropagate_amaf(tree, current, root, pl, &amaf, wins, visits);
+		}
+		TERESA_PROFILE_MARK(TERESA_PHASE_BACKPROP);
+
+		if (sampled) {
+			uint64_t ticks[TERESA_PHASES];
+			for (int p = 0; p < TERESA_PHASES; ++p) {
+				ticks[p] = stamps[p + 1] - stamps[p];
+			}
+			teresa_profile_add(profile, ticks);
+		}
+	}
+}
+
+static void* teresa_worker_main(void* arg) {
+	teresa_search_run(arg);
+	return NULL;
+}
+
+// Search every tree of params from st0 until budget runs out; ownership collects the playouts if given,
+// profile the phase timings of all threads (if given & params->profile is set)
+// Root-parallel runs one thread per tree, without virtual loss since nobody shares a path
+// Leaf-parallel runs one search thread, the others only help it with playouts
+static void teresa_run_search(teresa_params* params, state* st0, color me, int N, teresa_budget* budget, teresa_ownership* ownership, teresa_profile* profile) {
+	int threads = max(params->threads, 1);
+	bool root_parallel = params->ntrees > 1;
+	bool leaf_parallel = params->parallel == TERESA_LEAF_PARALLEL && threads > 1;
+
+	budget->N = N;
+
+	teresa_pool pool;
+	if (leaf_parallel) {
+		teresa_pool_init(&pool, threads - 1, me);
+	}
+
+	// Calling thread is worker 0
+	teresa_worker workers[threads];
+	for (int k = 0; k < threads; ++k) {
+		teresa_tree* worker_tree = params->trees[root_parallel ? k : 0];
+		workers[k].search = (teresa_search) {
+			.params = params,
+			.tree = worker_tree,
+			.root = worker_tree->root,
+			.st0 = st0,
+			.me = me,
+			.N = N,
+			.virtual_loss = (threads > 1 && !root_parallel && !leaf_parallel) ? params->virtual_loss : 0,
+			.batch = max(params->batch, 1),
+			.budget = budget,
+		};
+		workers[k].pool = leaf_parallel ? &pool : NULL;
+		rng_split(&params->rng, &workers[k].rng);
+		teresa_ownership_clear(&workers[k].ownership);
+		workers[k].profile = NULL;
+		if (profile && params->profile > 0 && !(leaf_parallel && k > 0)) {
+			workers[k].profile = calloc(1, sizeof(teresa_profile));
+			assert(workers[k].profile);
+			rng_split(&params->profile_rng, &workers[k].profile->rng);
+		}
+	}
+	for (int k = 1; k < threads; ++k) {
+		pthread_create(&workers[k].thread, NULL, leaf_parallel ? teresa_helper_main : teresa_worker_main, &workers[k]);
+	}
+	teresa_search_run(&workers[0]);
+	if (leaf_parallel) {
+		teresa_pool_stop(&pool);
+	}
+	for (int k = 1; k < threads; ++k) {
+		pthread_join(workers[k].thread, NULL);
+	}
+	if (leaf_parallel) {
+		teresa_pool_destroy(&pool);
+	}
+
+	if (ownership) {
+		for (int k = 0; k < threads; ++k) {
+			teresa_ownership_merge(ownership, &workers[k].ownership);
+		}
+	}
+
+	for (int k = 0; k < threads; ++k) {
+		if (workers[k].profile) {
+			teresa_profile_merge(profile, workers[k].profile);
+			free(workers[k].profile);
+		}
+	}
+}
+
+// Searches the position after Teresa's move until stopped, on the tree later promoted by teresa_observe
+typedef struct teresa_ponder {
+	teresa_params* params;
+	state st;
+	color me;
+	teresa_budget budget;
+	pthread_t thread;
+} teresa_ponder;
+
+static void* teresa_ponder_main(void* arg) {
+	teresa_ponder* ponder = arg;
+	teresa_run_search(ponder->params, &ponder->st, ponder->me, INT_MAX - 4096, &ponder->budget, NULL, NULL);
+	return NULL;
+}
+
+// Start pondering on st, where the opponent is to play; does nothing unless params->ponder is set
+void teresa_ponder_start(player* self, state* st) {
+	teresa_params* params = self->params;
+	if (!params->ponder || params->pondering || go_is_game_over(st)) return;
+
+	teresa_params_init(params);
+	if (!params->tree->root) return;	// Resigned
+
+	teresa_ponder* ponder = malloc(sizeof(teresa_ponder));
+	assert(ponder);
+	ponder->params = params;
+	state_copy(st, &ponder->st);
+	ponder->me = color_opponent(st->nextPlayer);
+	ponder->budget = (teresa_budget) {.iterations = 0, .stop = false, .open_ended = true, .start = 0, .soft_deadline = 0, .hard_deadline = 0};
+
+	params->pondering = ponder;
+	pthread_create(&ponder->thread, NULL, teresa_ponder_main, ponder);
+}
+
+// Stop pondering & wait for the search threads; safe to call when not pondering
+void teresa_ponder_stop(player* self) {
+	teresa_params* params = self->params;
+	teresa_ponder* ponder = params->pondering;
+	if (!ponder) return;
+
+	__atomic_store_n(&ponder->budget.stop, true, __ATOMIC_RELAXED);
+	pthread_join(ponder->thread, NULL);
+
+	if (TERESA_DEBUG) {
+		wprintf(L"Pondered %d playouts\n", ponder->budget.iterations);
+	}
+
+	params->pondering = NULL;
+	free(ponder);
+}
+
+// params.N, params.C must be defined
+// Search st0 for me within the budget of params, then count the root children of every tree to choose from
+static void teresa_think(teresa_params* params, state* st0, color me, teresa_root_counts* counts) {
+	teresa_pick_most_visited_check();
+
+	teresa_tree* tree = params->tree;
+	teresa_node root = tree->root;
+
+	teresa_budget budget = {.iterations = 0, .stop = false, .open_ended = false, .start = 0, .soft_deadline = 0, .hard_deadline = 0};
+	int N = params->N;
+	if (params->soft_time > 0) {
+		uint64_t now = timer_ticks();
+		budget.start = now;
+		budget.soft_deadline = now + timer_ns_to_ticks(params->soft_time * 1e9);
+		budget.hard_deadline = now + timer_ns_to_ticks(fmax(params->hard_time, params->soft_time) * 1e9);
+		N = INT_MAX - 4096;	// Clock decides, headroom for the last increments
+	}
+
+	teresa_profile* profile = NULL;
+	if (params->profile > 0) {
+		if (!params->last_profile) {
+			params->last_profile = malloc(sizeof(teresa_profile));
+			assert(params->last_profile);
+		}
+		profile = params->last_profile;
+		memset(profile, 0, sizeof(teresa_profile));
+		rng_split(&params->profile_rng, &profile->rng);
+	}
+
+	teresa_ownership_clear(params->ownership);
+	params->ownership->key = state_hash(st0);
+	uint64_t t0 = timer_now();
+	teresa_run_search(params, st0, me, N, &budget, params->ownership, profile);
+	params->stats.playouts = min(budget.iterations, N);
+	params->stats.seconds = (timer_now() - t0) / 1e9;
+
+	if (profile) {
+		teresa_profile_print(stderr, profile);
+	}
+
+	// The first tree lists the children; in root-parallel mode it may not have expanded its root itself
+	if (params->ntrees > 1 && teresa_claim_expansion(tree, root)) {
+		teresa_expand(st0, tree, root, params);
+	}
+	teresa_count_root(params, counts);
+}
+
+move_result teresa_play(player* self, state* st0, move* mv) {
+	teresa_ponder_stop(self);
+
+	color me = st0->nextPlayer;
+
+	teresa_params_init(self->params);
+	teresa_params* params = (teresa_params*) self->params;
+
+	rng* r = &params->rng;
+	teresa_tree* tree = params->tree;
+	teresa_node root = tree->root;
+
+	// Nothing to think about with a single move to choose from, or a move from the book
+	move list[NMOVES];
+	int nlist = go_get_reasonable_moves(st0, list);
+	bool decided = nlist == 1;
+	if (!decided && params->book) {
+		decided = book_lookup(params->book, st0, &list[0]);
+	}
+	if (decided) {
+		teresa_ownership_clear(params->ownership);
+		for (int k = 0; k < params->ntrees; ++k) {
+			teresa_tree_advance(params->trees[k], list[0]);
+		}
+		*mv = list[0];
+		return go_play_move(st0, mv);
+	}
+
+	teresa_root_counts counts;
+	teresa_think(params, st0, me, &counts);
+
+	// Select most visited move (done thinking through all courses of action)
+	int best_idx = teresa_pick_most_visited(counts.visits, counts.flags, counts.n, r);
+
+	// Root never got its children (node pool full, or stopped right away): any reasonable move will do
+	if (best_idx < 0) {
+		*mv = list[RANDI(r, 0, nlist)];
+		for (int k = 0; k < params->ntrees; ++k) {
+			teresa_tree_advance(params->trees[k], *mv);
+		}
+		return go_play_move(st0, mv);
+	}
+
+	teresa_node best_node = counts.node[best_idx];
+	move best = NODE_MV(best_node);
+
+	if (TERESA_DEBUG) {
 		// wprintf(L"\nDecision heatmap\n");
 		// teresa_old_print_heatmap(st0, root);
 
 		wprintf(L"Win estimated at %.1f%%\n", node_pwin(tree, best_node)*100);
 		wprintf(L"Confidence is %.1f%%\n", (float)NODE_VISITS(best_node)/NODE_VISITS(NODE_PARENT(best_node))*100);
 
-		wprintf(L"This tree had %d out of %d nodes total (before move)\n", NODE_VISITS(root), teresa_node_count);
+		wprintf(L"This tree had %d visits out of %d nodes total (before move)\n", NODE_VISITS(root), tree->used);
+
+		teresa_tt* tt = &tree->tt;
+		wprintf(L"Transpositions: %llu hits out of %llu lookups (%.1f%%), %llu playouts inherited, %llu positions left out\n",
+			(unsigned long long) tt->hits, (unsigned long long) tt->lookups, tt->lookups ? 100.0 * tt->hits / tt->lookups : 0.0,
+			(unsigned long long) tt->inherited, (unsigned long long) tt->full);
 	}
 
 	// TODO Uncomment once adapted to new node structure
@@ -535,117 +1864,522 @@ move_result teresa_play(player* self, state* st0, move* mv) {
 	// 	g2(root, "graph3.json", 8, 8);
 	// }
 
-	// Resign if under win threshold :/
-	if ((float)NODE_WINS(best_node) / NODE_VISITS(best_node) < TERESA_RESIGN_THRESHOLD) {
-		teresa_node_destroy(tree, root);
-		tree->root = NODE_NULL;
+	// Resign if proven lost or under win threshold :/
+	bool proven_won = counts.flags[best_idx] & TERESA_FLAG_WON;
+	bool proven_lost = counts.flags[best_idx] & TERESA_FLAG_LOST;
+	if (proven_lost || (!proven_won && (float)counts.wins[best_idx] / counts.visits[best_idx] < TERESA_RESIGN_THRESHOLD)) {
+		for (int k = 1; k < params->ntrees; ++k) {
+			teresa_tree_clear(params->trees[k]);
+		}
+		teresa_tree_discard_root(tree);
 		*mv = MOVE_RESIGN;
 		return go_play_move(st0, mv);
 	}
 
 	// Destroy now useless children (forget everything unrelated to selected best move)
-	teresa_destroy_all_children_except_one(tree, root, best_node);
-	tree->root = root = best_node;
+	params->stats.reuse = NODE_VISITS(root) ? (float) NODE_VISITS(best_node) / NODE_VISITS(root) : 0;
+	for (int k = 0; k < params->ntrees; ++k) {
+		teresa_tree_advance(params->trees[k], best);
+	}
+	root = tree->root;
 
 	if (TERESA_DEBUG) {
-		wprintf(L"This tree has %d out of %d nodes total (after move)\n", NODE_VISITS(root), teresa_node_count);
+		wprintf(L"This tree has %d visits out of %d nodes total (after move)\n", NODE_VISITS(root), tree->used);
 	}
 
 	*mv = best;
 	return go_play_move(st0, &best);
 }
 
-static void teresa_reset_all_trace_of_move(teresa_tree* tree, teresa_node nd, move* mv) {
-	teresa_node child = NODE_CHILD(nd);
-	teresa_node prev = NODE_NULL;
-	teresa_node next = NODE_NULL;
-	// Once mv found, reset whole branch
-	while (child) {
-		if (NODE_MV(child) == *mv) {
-			next = NODE_SIBLING(child);
-			NODE_WINS(child) = 0;
-			NODE_VISITS(child) = 0;
-			if (NODE_CHILD(child)) {
-				teresa_destroy_all_children_except_one(tree, child, NODE_NULL);
-			}
-			break;
+// Search st without playing; fills the moves of the root with their wins (for the player to move) & visits,
+// most visited first, and returns how many there are
+// The tree stays at st, so a teresa_play on st right after goes on from this search
+int teresa_analyze(player* self, state* st, move* moves, uint32_t* wins, uint32_t* visits) {
+	teresa_ponder_stop(self);
+	teresa_params_init(self->params);
+	teresa_params* params = self->params;
+
+	teresa_root_counts counts;
+	teresa_think(params, st, st->nextPlayer, &counts);
+
+	teresa_tree* tree = params->tree;
+	int n = counts.n;
+	for (int i = 0; i < n; ++i) {
+		int j = i;
+		for (; j > 0 && visits[j-1] < counts.visits[i]; --j) {
+			moves[j] = moves[j-1];
+			wins[j] = wins[j-1];
+			visits[j] = visits[j-1];
 		}
-		prev = child;
-		child = NODE_SIBLING(child);
+		moves[j] = NODE_MV(counts.node[i]);
+		wins[j] = counts.wins[i];
+		visits[j] = counts.visits[i];
 	}
+	return n;
+}
 
-	// Repair rest of tree after mass destruction
-	if (next) {
-		if (!prev) {
-			NODE_CHILD(nd) = next;
-		} else {
-			NODE_SIBLING(prev) = next;
+static void teresa_stats_walk(teresa_tree* tree, teresa_node nd, int depth, teresa_stats* stats) {
+	stats->depth[min(depth, TERESA_STATS_DEPTH - 1)]++;
+	stats->branching[NODE_NCHILDREN(nd)]++;
+	teresa_node first = NODE_CHILD(nd);
+	for (int i = 0; i < NODE_NCHILDREN(nd); ++i) {
+		teresa_stats_walk(tree, first + i, depth + 1, stats);
+	}
+}
+
+// Last search & reuse as recorded, node pools & tables as they are now; histograms are of the first tree only
+void teresa_get_stats(player* self, teresa_stats* stats) {
+	teresa_ponder_stop(self);
+	teresa_params* params = self->params;
+
+	*stats = params->stats;
+	stats->nodes = stats->capacity = stats->high_water = stats->allocated = stats->released = stats->heap_bytes = 0;
+	stats->tt_lookups = stats->tt_hits = stats->tt_full = stats->tt_inherited = 0;
+	memset(stats->depth, 0, sizeof(stats->depth));
+	memset(stats->branching, 0, sizeof(stats->branching));
+	if (!params->trees) return;
+
+	for (int k = 0; k < params->ntrees; ++k) {
+		teresa_tree* tree = params->trees[k];
+		stats->nodes += tree->used;
+		stats->capacity += tree->capacity - 1;
+		stats->high_water += tree->high_water;
+		stats->allocated += tree->allocated;
+		stats->released += tree->released;
+		stats->heap_bytes += (uint64_t) tree->garbage_size * sizeof(teresa_block)
+			+ (uint64_t) (tree->tt.mask + 1) * sizeof(teresa_tt_entry);
+		stats->tt_lookups += tree->tt.lookups;
+		stats->tt_hits += tree->tt.hits;
+		stats->tt_full += tree->tt.full;
+		stats->tt_inherited += tree->tt.inherited;
+	}
+
+	if (params->tree->root) {
+		teresa_stats_walk(params->tree, params->tree->root, 0, stats);
+	}
+}
+
+static const char* teresa_phase_names[TERESA_PHASES] = {"upkeep", "copy", "descent", "expansion", "playout", "backprop"};
+
+// Durations of a phase in ns: over the samples taken, over all iterations (estimated) & percentiles of the kept ones
+typedef struct {
+	double total;
+	double estimated;
+	double mean;
+	double p50;
+	double p90;
+	double p99;
+} teresa_phase_summary;
+
+static int teresa_compare_ticks(const void* a, const void* b) {
+	uint32_t x = *(const uint32_t*) a;
+	uint32_t y = *(const uint32_t*) b;
+	return (x > y) - (x < y);
+}
+
+static void teresa_profile_summarize(teresa_profile* profile, teresa_phase_summary* summary) {
+	uint64_t kept = (profile->samples < TERESA_PROFILE_SAMPLES) ? profile->samples : TERESA_PROFILE_SAMPLES;
+	uint32_t* sorted = malloc((kept + 1) * sizeof(uint32_t));
+	assert(sorted);
+
+	for (int p = 0; p < TERESA_PHASES; ++p) {
+		teresa_phase_summary* sum = &summary[p];
+		memset(sum, 0, sizeof(teresa_phase_summary));
+		if (!profile->samples) continue;
+
+		sum->total = timer_ticks_to_ns(profile->total[p]);
+		sum->estimated = sum->total * profile->iterations / profile->samples;
+		sum->mean = sum->total / profile->samples;
+
+		for (uint64_t k = 0; k < kept; ++k) {
+			sorted[k] = profile->ticks[k][p];
 		}
+		qsort(sorted, kept, sizeof(uint32_t), teresa_compare_ticks);
+		sum->p50 = timer_ticks_to_ns(sorted[(kept - 1) * 50 / 100]);
+		sum->p90 = timer_ticks_to_ns(sorted[(kept - 1) * 90 / 100]);
+		sum->p99 = timer_ticks_to_ns(sorted[(kept - 1) * 99 / 100]);
 	}
 
-	// Recurse on each child
-	child = NODE_CHILD(nd);
-	while (child) {
-		teresa_reset_all_trace_of_move(tree, child, mv);
-		child = NODE_SIBLING(child);
+	free(sorted);
+}
+
+// One line per phase: share of sampled time, estimated seconds over the search (summed over threads),
+// mean & percentiles in µs
+void teresa_profile_print(FILE* stream, teresa_profile* profile) {
+	teresa_phase_summary summary[TERESA_PHASES];
+	teresa_profile_summarize(profile, summary);
+
+	double all = 0;
+	for (int p = 0; p < TERESA_PHASES; ++p) {
+		all += summary[p].total;
+	}
+
+	fwprintf(stream, L"Profiled %llu of %llu iterations\n",
+		(unsigned long long) profile->samples, (unsigned long long) profile->iterations);
+	fwprintf(stream, L"%-10s %6s %9s %9s %9s %9s %9s\n", "phase", "share", "total s", "mean us", "p50 us", "p90 us", "p99 us");
+	for (int p = 0; p < TERESA_PHASES; ++p) {
+		teresa_phase_summary* sum = &summary[p];
+		fwprintf(stream, L"%-10s %5.1f%% %9.3f %9.2f %9.2f %9.2f %9.2f\n", teresa_phase_names[p],
+			all > 0 ? 100 * sum->total / all : 0.0, sum->estimated / 1e9,
+			sum->mean / 1e3, sum->p50 / 1e3, sum->p90 / 1e3, sum->p99 / 1e3);
+	}
+}
+
+// Same figures as teresa_profile_print, in ns, as one JSON object
+bool teresa_profile_dump(teresa_profile* profile, const char* path) {
+	FILE* f = fopen(path, "w");
+	if (!f) {
+		return false;
+	}
+
+	teresa_phase_summary summary[TERESA_PHASES];
+	teresa_profile_summarize(profile, summary);
+
+	fprintf(f, "{\"iterations\": %llu, \"samples\": %llu, \"phases\": {",
+		(unsigned long long) profile->iterations, (unsigned long long) profile->samples);
+	for (int p = 0; p < TERESA_PHASES; ++p) {
+		teresa_phase_summary* sum = &summary[p];
+		fprintf(f, "%s\n  \"%s\": {\"total_ns\": %.0f, \"estimated_ns\": %.0f, \"mean_ns\": %.1f, "
+			"\"p50_ns\": %.0f, \"p90_ns\": %.0f, \"p99_ns\": %.0f}",
+			p ? "," : "", teresa_phase_names[p], sum->total, sum->estimated, sum->mean, sum->p50, sum->p90, sum->p99);
+	}
+	fprintf(f, "\n}}\n");
+
+	return fclose(f) == 0;
+}
+
+static void teresa_reset_all_trace_of_move(teresa_tree* tree, teresa_node nd, move* mv) {
+	teresa_node first = NODE_CHILD(nd);
+	for (int i = 0; i < NODE_NCHILDREN(nd); ++i) {
+		teresa_node child = first + i;
+		if (NODE_MV(child) == *mv) {
+			// Once mv found, reset whole branch; the node itself stays in its block
+			NODE_STATS(child) = 0;
+			if (NODE_NCHILDREN(child)) {
+				teresa_garbage_push(tree, NODE_CHILD(child), NODE_NCHILDREN(child));
+				NODE_CHILD(child) = NODE_NULL;
+				NODE_NCHILDREN(child) = 0;
+				NODE_FLAGS(child) = 0;
+			}
+		} else {
+			// Recurse on each other child
+			teresa_reset_all_trace_of_move(tree, child, mv);
+		}
 	}
 }
 
 void teresa_tree_destroy(teresa_tree* tree) {
-	teresa_node_destroy(tree, tree->root);
+	if (tree->root) {
+		teresa_tree_discard_root(tree);
+	}
+	teresa_tree_collect(tree, UINT32_MAX);
+	free(tree->garbage);
+	free(tree->tt.entries);
+	munmap(tree->reservation, tree->reservation_size);
+	pthread_mutex_destroy(&tree->commit_lock);
 	free(tree);
 }
 
 void teresa_reset(player* self) {
 	if (!self) return;
+	teresa_ponder_stop(self);
 
 	teresa_params* params = self->params;
-	if (params->tree) {
-		teresa_tree_destroy(params->tree);
+	if (params->trees) {
+		for (int k = 0; k < params->ntrees; ++k) {
+			teresa_tree_destroy(params->trees[k]);
+		}
+		free(params->trees);
+		params->trees = NULL;
 		params->tree = NULL;
 	}
+	if (params->ownership) {
+		teresa_ownership_clear(params->ownership);
+	}
+}
+
+// Bytes of a snapshot of nodes 0 to n: header page, then every array on pages of its own
+static size_t teresa_snapshot_size(uint32_t n) {
+	teresa_tree* tree = NULL;
+	size_t size = page_round(sizeof(teresa_snapshot_header));
+#define X(field) size += page_round(((size_t) n + 1) * sizeof(*tree->field));
+	TERESA_TREE_ARRAYS(X)
+#undef X
+	return size;
+}
+
+// Snapshots hold no transposition table: nodes that inherited nothing may link afresh once loaded
+static void teresa_snapshot_unlink(uint8_t* flags, uint32_t n) {
+	for (uint32_t k = 1; k <= n; ++k) {
+		if (!(flags[k] >> TERESA_FLAG_INHERITED_SHIFT)) {
+			flags[k] &= ~TERESA_FLAG_LINKED;
+		}
+	}
+}
+
+// Write bytes, then zeros up to the next page
+static bool teresa_snapshot_write(FILE* f, const void* data, size_t bytes) {
+	static const char zeros[4096] = {0};
+	if (fwrite(data, 1, bytes, f) != bytes) {
+		return false;
+	}
+	for (size_t pad = page_round(bytes) - bytes; pad; ) {
+		size_t chunk = min_size(pad, sizeof(zeros));
+		if (fwrite(zeros, 1, chunk, f) != chunk) {
+			return false;
+		}
+		pad -= chunk;
+	}
+	return true;
+}
+
+// Write the subtree below the root of the first tree & the position st it stands for (see teresa_snapshot_header)
+// Nodes are renumbered breadth-first from 1, so the file holds no holes; transposition links are left out
+bool teresa_save(player* self, state* st, const char* path) {
+	teresa_ponder_stop(self);
+	teresa_params_init(self->params);
+
+	teresa_params* params = self->params;
+	teresa_tree* tree = params->tree;
+
+	// order[k]: node of the tree that becomes node k; parents & children renumbered along
+	uint32_t size = tree->used + 1;
+	teresa_node* order = malloc(size * sizeof(teresa_node));
+	teresa_node* parent = malloc(size * sizeof(teresa_node));
+	teresa_node* child = malloc(size * sizeof(teresa_node));
+	size_t largest = 0;
+#define X(field) largest = max_size(largest, sizeof(*tree->field));
+	TERESA_TREE_ARRAYS(X)
+#undef X
+	void* buffer = malloc(size * largest);
+	assert(order && parent && child && buffer);
+
+	uint32_t n = 1;
+	parent[0] = NODE_NULL;
+	child[0] = NODE_NULL;
+	order[1] = tree->root;
+	parent[1] = NODE_NULL;
+	for (uint32_t k = 1; k <= n; ++k) {
+		teresa_node nd = order[k];
+		int nchildren = NODE_NCHILDREN(nd);
+		child[k] = nchildren ? n + 1 : NODE_NULL;
+		for (int i = 0; i < nchildren; ++i) {
+			order[++n] = NODE_CHILD(nd) + i;
+			parent[n] = k;
+		}
+	}
+
+	teresa_snapshot_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TERESA_SNAPSHOT_MAGIC, 4);
+	header.version = TERESA_SNAPSHOT_VERSION;
+	header.width = WIDTH;
+	header.height = HEIGHT;
+	header.node_bytes = teresa_node_bytes();
+	header.page = sysconf(_SC_PAGESIZE);
+	header.nodes = n;
+	state_encode(st, &header.position);
+
+	FILE* f = fopen(path, "wb");
+	bool ok = f && teresa_snapshot_write(f, &header, sizeof(header));
+
+	// One array at a time, gathered in node order; node 0 is written too, as zeros
+#define X(field) \
+	if (ok) { \
+		__typeof__(tree->field) out = buffer; \
+		memset(out, 0, sizeof(*out)); \
+		for (uint32_t k = 1; k <= n; ++k) { \
+			out[k] = tree->field[order[k]]; \
+		} \
+		if ((void*) tree->field == (void*) tree->parent) { \
+			memcpy(out, parent, (n + 1) * sizeof(*out)); \
+		} else if ((void*) tree->field == (void*) tree->child) { \
+			memcpy(out, child, (n + 1) * sizeof(*out)); \
+		} else if ((void*) tree->field == (void*) tree->flags) { \
+			teresa_snapshot_unlink((uint8_t*) out, n); \
+		} \
+		ok = teresa_snapshot_write(f, out, (n + 1) * sizeof(*out)); \
+	}
+	TERESA_TREE_ARRAYS(X)
+#undef X
+
+	free(order);
+	free(parent);
+	free(child);
+	free(buffer);
+
+	if (f && fclose(f) != 0) {
+		ok = false;
+	}
+	return ok;
+}
+
+// Tree whose arrays are the ones of a snapshot, mapped copy-on-write in place; NULL if they don't fit
+static teresa_tree* teresa_tree_load(int fd, teresa_snapshot_header* header, size_t memory, size_t tt_memory) {
+	teresa_tree* tree = malloc(sizeof(teresa_tree));
+	assert(tree);
+	teresa_tree_init(tree, memory, tt_memory);
+
+	uint32_t n = header->nodes;
+	if ((uint64_t) n + 1 + TERESA_NODE_RESERVE > tree->capacity) {
+		teresa_tree_destroy(tree);
+		return NULL;
+	}
+
+	bool ok = true;
+	off_t offset = page_round(sizeof(teresa_snapshot_header));
+#define X(field) \
+	if (ok) { \
+		size_t bytes = page_round(((size_t) n + 1) * sizeof(*tree->field)); \
+		ok = mmap(tree->field, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset) != MAP_FAILED; \
+		offset += bytes; \
+	}
+	TERESA_TREE_ARRAYS(X)
+#undef X
+	if (!ok) {
+		teresa_tree_destroy(tree);
+		return NULL;
+	}
+
+	// Later commits just extend the mapped pages with anonymous ones
+	tree->high_water = n + 1;
+	tree->committed = n + 1;
+	tree->used = n;
+	tree->allocated = n;
+	tree->root = 1;
+
+	return tree;
+}
+
+// Replace the first tree by a snapshot written by teresa_save, & st by its position; false if it can't be used
+// The file is mapped, not read: pages come in as the search walks them; don't rewrite it while in use
+bool teresa_load(player* self, state* st, const char* path) {
+	teresa_ponder_stop(self);
+	teresa_params_init(self->params);
+
+	teresa_params* params = self->params;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	teresa_snapshot_header header;
+	struct stat sb;
+	state position;
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header)
+		|| memcmp(header.magic, TERESA_SNAPSHOT_MAGIC, 4) != 0
+		|| header.version != TERESA_SNAPSHOT_VERSION
+		|| header.width != WIDTH || header.height != HEIGHT
+		|| header.node_bytes != teresa_node_bytes()
+		|| header.page != sysconf(_SC_PAGESIZE)
+		|| header.nodes < 1
+		|| fstat(fd, &sb) != 0 || (size_t) sb.st_size != teresa_snapshot_size(header.nodes)
+		|| !state_decode(&position, &header.position)) {
+		close(fd);
+		return false;
+	}
+
+	size_t memory = params->memory ? params->memory : TERESA_DEFAULT_MEMORY;
+	size_t tt_memory = params->tt_memory ? params->tt_memory : TERESA_DEFAULT_TT_MEMORY;
+	teresa_tree* loaded = teresa_tree_load(fd, &header, memory / params->ntrees, tt_memory / params->ntrees);
+	close(fd);
+	if (!loaded) {
+		return false;
+	}
+
+	teresa_tree_destroy(params->trees[0]);
+	params->trees[0] = loaded;
+	params->tree = loaded;
+
+	// Private trees of a root-parallel search start over from the position
+	for (int k = 1; k < params->ntrees; ++k) {
+		teresa_tree_clear(params->trees[k]);
+	}
+	teresa_ownership_clear(params->ownership);
+
+	state_copy(&position, st);
+	return true;
+}
+
+// Expected owner of every point (1 for Black, -1 for White) & expected score (Black - White)
+// Uses the playouts of the last search, or plainly counts the current board if there were none
+// Owners & score as the last search saw them, if it was about st; else from fresh playouts of st
+void teresa_estimate(player* self, state* st, float ownership[COUNT], float* score) {
+	teresa_ponder_stop(self);
+	teresa_params* params = self->params;
+	teresa_ownership* own = params->ownership;
+
+	if (own && !go_is_game_over(st) && (!own->playouts || own->key != state_hash(st))) {
+		teresa_ownership_clear(own);
+		for (int i = 0; i < TERESA_ESTIMATE_PLAYOUTS; ++i) {
+			state playout;
+			playout_result result;
+			state_copy(st, &playout);
+			go_play_out(&playout, &result, &params->rng);
+			teresa_ownership_add(own, &result);
+		}
+		own->key = state_hash(st);
+	}
+
+	if (own && own->playouts && own->key == state_hash(st)) {
+		for (int i = 0; i < COUNT; ++i) {
+			ownership[i] = (float) own->owner[i] / own->playouts;
+		}
+		*score = own->score / own->playouts;
+	} else {
+		playout_result result;
+		go_get_result(st, &result);
+		for (int i = 0; i < COUNT; ++i) {
+			ownership[i] = (result.owner[i] == BLACK) - (result.owner[i] == WHITE);
+		}
+		*score = result.score[BLACK] - result.score[WHITE];
+	}
 }
 
 void teresa_observe(player* self, state* st, color opponent, move* opponent_mv) {
 	st = st;	// @gcc pls dont warn kthx
 	opponent = opponent;	// @gcc same
 
+	teresa_ponder_stop(self);
+
 	teresa_params* params = self->params;
 	teresa_tree* tree = params->tree;
 	if (!tree) return;
 	teresa_node root = tree->root;
+	params->stats.reuse = 0;
 
 	if (TERESA_DEBUG) {
-		wprintf(L"This tree had %d visits out of %d nodes total (before observing)\n", NODE_VISITS(root), teresa_node_count);
+		wprintf(L"This tree had %d visits out of %d nodes total (before observing)\n", NODE_VISITS(root), tree->used);
 	}
 
-	// Look for node with opponent_mv
-	teresa_node child = NODE_CHILD(root);
-	teresa_node found = NODE_NULL;
-	while (child) {
-		if (NODE_MV(child) == *opponent_mv) {
-			found = child;
-		}
-		child = NODE_SIBLING(child);
+	// Private trees of a root-parallel search follow along on their own
+	for (int k = 1; k < params->ntrees; ++k) {
+		teresa_tree_advance(params->trees[k], *opponent_mv);
 	}
 
+	// Look for node with opponent_mv
+	teresa_node found = teresa_find_child(tree, root, *opponent_mv);
+
 	if (found) {
 		if (TERESA_DEBUG) {
 			wprintf(L"Win estimated at %.1f%%\n", node_pwin(tree, found)*100);
 			wprintf(L"Move is %.1f%% probable\n", (float)NODE_VISITS(found)/NODE_VISITS(root)*100);
 			
-			teresa_node expected = teresa_select_most_visited_child(tree, root);
+			teresa_node expected = teresa_select_most_visited_child(tree, root, &params->rng);
 			if (expected == found) {
 				wprintf(L"This is the expected move");
 			} else {
 				wprintf(L"Expected move is ");
-				move_print(&NODE_MV(expected));
+				move mv = NODE_MV(expected);
+				move_print(&mv);
 			}
 			wprintf(L" (%.1f%% win, %.1f%% confidence)\n", node_pwin(tree, expected)*100, (float)NODE_VISITS(expected)/NODE_VISITS(root)*100);
 		}
 		
-		teresa_destroy_all_children_except_one(tree, root, found);
-		tree->root = root = found;
+		params->stats.reuse = NODE_VISITS(root) ? (float) NODE_VISITS(found) / NODE_VISITS(root) : 0;
+		teresa_tree_advance(tree, *opponent_mv);
+		root = tree->root;
 	} else if (*opponent_mv == MOVE_PASS) {
 		if (TERESA_DEBUG) {
 			wprintf(L"I observed an unexpected pass, which confuses me\n");
@@ -673,22 +2407,19 @@ void teresa_observe(player* self, state* st, color opponent, move* opponent_mv)
 	// Look at all children of node; find move opponent_mv, and delete the whole branch; then going through each child, repeat
 	// teresa_old_reset_all_trace_of_move(root, opponent_mv);
 
-	if (TERESA_DEBUG) {
-		wprintf(L"This tree has %d visits out of %d nodes total (after observation)\n", NODE_VISITS(root), teresa_node_count);
+	if (TERESA_DEBUG && params->tree) {
+		wprintf(L"This tree has %d visits out of %d nodes total (after observation)\n", NODE_VISITS(root), tree->used);
 	}
 }
 
 // Matching defines at top of file
 #undef NODE_NULL
 #undef NODE_PARENT
-#undef NODE_SIBLING
 #undef NODE_CHILD
-#undef NODE_PL
+#undef NODE_NCHILDREN
+#undef NODE_FLAGS
 #undef NODE_MV
+#undef NODE_STATS
 #undef NODE_WINS
 #undef NODE_VISITS
-#undef NODE_PWIN
-#undef NODE_SQLG_VISITS
-#undef NODE_RSQRT_VISITS
-#undef NODE_UNEXPLORED_MOVES
-#undef NODE_UNEXPLORED_COUNT
+#undef NODE_AMAF
@@ -1,33 +1,150 @@
 #ifndef PLAYERS_TERESA_H
 #define PLAYERS_TERESA_H
 
-#define TERESA_MAX_NODES 60000000
+#include <pthread.h>
+#include <stdio.h>
+#include "book.h"
+#include "patterns.h"
+
+// Memory for the node arrays of all trees of a player, unless params->memory says otherwise
+#define TERESA_DEFAULT_MEMORY ((size_t) 2048 << 20)
+// Memory for the transposition tables of all trees of a player, unless params->tt_memory says otherwise
+#define TERESA_DEFAULT_TT_MEMORY ((size_t) 64 << 20)
+// Slots looked at for a position before giving up on it
+#define TERESA_TT_PROBES 8
+// A node reaching a known position starts with at most this many of its playouts (kept in 4 bits of its flags)
+#define TERESA_TT_INHERIT 15
+// Transposition table slots of a descent are remembered this many moves deep; deeper positions are left out
+#define TERESA_PATH_MAX 128
+// Nodes committed at once as a tree grows
+#define TERESA_COMMIT_CHUNK 65536
 #define TERESA_RESIGN_THRESHOLD 0.05
 #define TERESA_DEBUG 0
 
+// Clock & node pool are looked at every this many playouts of a thread
+#define TERESA_CHECK_INTERVAL 64
+// Discarded nodes released by a search thread per playout (whole blocks, so one block at least)
+#define TERESA_COLLECT_BATCH 16
+// Leaves get their children once visited this many times (the root right away)
+#define TERESA_EXPAND_VISITS 8
+// Visit counts below this get sqrt(log(n)) & 1/sqrt(n) from tables in UCB
+#define TERESA_UCB_TABLE_SIZE 4096
+// AMAF counts of a node are halved once its AMAF visits reach this (they have 12 bits)
+#define TERESA_AMAF_HALVE 0x800
+// Move priors: how much a pass, a capture, saving a group in atari, an atari, playing within 2 of the last move
+// & playing on the first line weigh, relative to a plain move
+#define TERESA_PRIOR_PASS 0.01
+#define TERESA_PRIOR_CAPTURE 8
+#define TERESA_PRIOR_ESCAPE 4
+#define TERESA_PRIOR_ATARI 2
+#define TERESA_PRIOR_NEAR 2
+#define TERESA_PRIOR_EDGE 0.25
+// Priors are stored as fractions of this (TERESA_PRIOR_ONE for the best move, or for all with priors off)
+#define TERESA_PRIOR_ONE 255
+// Progressive widening opens one more child at this many visits, & every time visits grow by the rate
+#define TERESA_WIDEN_VISITS 40
+#define TERESA_WIDEN_RATE 1.4
+// Search stops when fewer nodes than this are left
+#define TERESA_NODE_RESERVE (1 << 16)
+// Win rates are only compared (see teresa_params.confidence) once the runner-up has this many visits
+#define TERESA_CONFIDENCE_VISITS 500
+// Past the soft deadline, keep going while best move has fewer than this many times the runner-up's visits
+#define TERESA_EXTEND_RATIO 1.5
+// Playouts run to estimate ownership of a position the last search was not about
+#define TERESA_ESTIMATE_PLAYOUTS 1000
+// Depths deeper than this are counted in the last bucket of teresa_stats.depth
+#define TERESA_STATS_DEPTH 64
+// Sampled iterations the profiler keeps for percentiles (see teresa_params.profile)
+#define TERESA_PROFILE_SAMPLES 4096
+
 typedef uint32_t teresa_node;
 
-// Simultaneously holds decision tree & flat "free" tree (only siblings)
-// Node 0 is reserved for NULL node (this means tree holds in fact TERESA_MAX_NODES-1 values)
-// In free tree, only sibling contains valid values
+// Nodes keep their move & their number of children in a byte each up to 11x11, in two bytes each on larger boards
+#if COUNT > 127
+typedef int16_t teresa_move;
+typedef uint16_t teresa_count;
+#else
+typedef int8_t teresa_move;
+typedef uint8_t teresa_count;
+#endif
+
+// Run of n consecutive nodes, e.g. all children of a node
+typedef struct {
+	teresa_node first;
+	uint16_t n;
+} teresa_block;
+
+// What every path to a position learned about it, from the point of view of whoever moved into it
+typedef struct {
+	uint64_t key;				// Generation << 56 | low 56 bits of the position's state_hash, 0 for a free slot
+	uint32_t wins;
+	uint32_t visits;
+} teresa_tt_entry;
+
+// Open addressing, lock-free: a slot is claimed by setting its key; positions are kept as the root moves on,
+// & a position no search has looked up since the last move gives its slot up to a new one with no room left
+struct teresa_tt;
+typedef struct teresa_tt {
+	teresa_tt_entry* entries;
+	uint32_t mask;				// Size - 1, a power of 2
+	uint32_t claimed;			// Slots taken since the last clear
+	uint8_t generation;			// Moves since the tree was started, wrapping; stamped on keys as they are looked up
+	uint64_t lookups;			// Counters are approximate when threads race, & kept over clears
+	uint64_t hits;				// Positions already known from another path
+	uint64_t full;				// Positions with no free slot left in reach
+	uint64_t inherited;			// Playouts handed to nodes by hits
+} teresa_tt;
+
+// Simultaneously holds decision tree & "free" lists of released blocks
+// Node 0 is reserved for NULL node (this means tree holds in fact capacity-1 values)
+// Children of a node are one block, all created when it is expanded; the root is a block of its own
+// Released blocks are kept in one free list per size, linked through child of their first node
+// Free list heads pack a pop counter above the node so concurrent pops can't suffer from ABA
+// Arrays live in one reservation of address space; pages are committed as high_water grows
 struct teresa_tree;
 typedef struct teresa_tree {
 	teresa_node root;
-	teresa_node freeroot;
-	teresa_node parent[TERESA_MAX_NODES];
-	teresa_node sibling[TERESA_MAX_NODES];
-	teresa_node child[TERESA_MAX_NODES];
-	color pl[TERESA_MAX_NODES];
-	move mv[TERESA_MAX_NODES];
-	uint32_t wins[TERESA_MAX_NODES];
-	uint32_t visits[TERESA_MAX_NODES];
-	float pwin[TERESA_MAX_NODES];
-	float sqlg_visits[TERESA_MAX_NODES];
-	float rsqrt_visits[TERESA_MAX_NODES];
-	move* unexplored_moves[TERESA_MAX_NODES];
-	uint16_t unexplored_count[TERESA_MAX_NODES];
+	uint64_t freelist[NMOVES + 1];	// Indexed by block size
+	uint32_t capacity;			// Nodes that fit in the reservation
+	uint32_t high_water;		// Next never-used node, handed out atomically
+	uint32_t committed;			// Nodes below this are backed by memory
+	uint32_t used;				// Nodes currently allocated, queued ones included
+	uint64_t allocated;			// Nodes ever handed out, & ever given back
+	uint64_t released;
+	teresa_block* garbage;		// Stack of discarded child blocks, subtrees included
+	uint32_t ngarbage;
+	uint32_t garbage_size;
+	bool collecting;			// Taken by the one thread releasing queued blocks
+	pthread_mutex_t commit_lock;
+	teresa_tt tt;
+	void* reservation;
+	size_t reservation_size;
+	teresa_node* parent;
+	teresa_node* child;			// First node of the children block
+	teresa_count* nchildren;
+	uint8_t* flags;
+	teresa_move* mv;					// Who played it follows from depth: players alternate, passes included
+	uint64_t* stats;			// Visits << 32 | wins, so both are updated at once
+	uint32_t* amaf;				// Prior << 24 | AMAF visits << 12 | AMAF wins; the prior is relative to the best move
+								// among siblings, in TERESA_PRIOR_ONE units
 } teresa_tree;
 
+#define TERESA_SNAPSHOT_MAGIC "TTRE"
+#define TERESA_SNAPSHOT_VERSION 3
+
+// Snapshot file layout (see teresa_save): this header on a page of its own, then for nodes 0 to nodes,
+// every node array in TERESA_TREE_ARRAYS order, each padded to a whole page so it can be mapped as is
+typedef struct {
+	char magic[4];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t node_bytes;		// Bytes per node over all arrays, to catch layout changes
+	uint32_t page;				// Page size the arrays are aligned to
+	uint32_t nodes;				// Node 1 is the root, children blocks follow breadth-first
+	state_code position;		// Where the root stands
+} teresa_snapshot_header;
+
 struct teresa_old_node;
 typedef struct teresa_old_node {
 	struct teresa_old_node* parent;	// 8b
@@ -45,17 +162,121 @@ typedef struct teresa_old_node {
 								// = 57b => 64b
 } teresa_old_node;
 
+// Final owners accumulated over the playouts of the last search
+struct teresa_ownership;
+typedef struct teresa_ownership {
+	int32_t owner[COUNT];	// +1 for each playout won by Black on that point, -1 for White
+	double score;			// Sum of final (Black - White) scores
+	uint32_t playouts;
+	uint64_t key;			// state_hash of the position the playouts started from, 0 for none
+} teresa_ownership;
+
+// What the last search did & what the trees of a player hold now (see teresa_get_stats)
 typedef struct {
-	int N;
+	uint32_t playouts;			// Of the last search
+	double seconds;
+	float reuse;				// Share of root visits kept by the last move played or observed (0 for none)
+	uint64_t nodes;				// Summed over all trees
+	uint64_t capacity;
+	uint64_t high_water;
+	uint64_t allocated;
+	uint64_t released;
+	uint64_t heap_bytes;		// Outside the node arrays: discarded block queues & transposition tables
+	uint64_t tt_lookups;
+	uint64_t tt_hits;
+	uint64_t tt_full;
+	uint64_t tt_inherited;
+	uint32_t depth[TERESA_STATS_DEPTH];	// Nodes of the first tree by distance from its root
+	uint32_t branching[NMOVES + 1];		// Nodes of the first tree by number of children (0 for leaves)
+} teresa_stats;
+
+// Parts of a search iteration, in the order they run
+typedef enum {
+	TERESA_PHASE_UPKEEP,		// Releasing discarded blocks & checking whether to stop
+	TERESA_PHASE_COPY,			// Copying the root position
+	TERESA_PHASE_DESCENT,		// Selection, replaying its moves down to a leaf
+	TERESA_PHASE_EXPANSION,		// Children of the leaf & the step into one of them
+	TERESA_PHASE_PLAYOUT,		// Playouts of the leaf, or its result if the game is over
+	TERESA_PHASE_BACKPROP,		// Real & AMAF statistics up to the root
+	TERESA_PHASES
+} teresa_phase;
+
+// Phase timings of every params.profile-th iteration of a search, in timer ticks
+struct teresa_profile;
+typedef struct teresa_profile {
+	uint64_t iterations;		// Sampled or not
+	uint64_t samples;			// Taken; the first TERESA_PROFILE_SAMPLES are kept, then a uniform subset
+	uint64_t total[TERESA_PHASES];	// Over all samples taken
+	rng rng;					// Picks the samples kept; never the search's own
+	uint32_t ticks[TERESA_PROFILE_SAMPLES][TERESA_PHASES];
+} teresa_profile;
+
+// How several search threads split the work
+typedef enum {
+	TERESA_TREE_PARALLEL,		// One tree shared by all threads
+	TERESA_ROOT_PARALLEL,		// One private tree per thread, root statistics merged before choosing
+	TERESA_LEAF_PARALLEL,		// One thread walks the tree, all of them run the playouts of each leaf
+} teresa_parallel_mode;
+
+typedef struct {
+	int N;						// Playouts per move, unless time is given
+	double soft_time;			// Seconds for next move; may stop after soft if choice is clear (0 for N playouts)
+	double hard_time;			// Never searches longer than this once soft_time is set
+	float confidence;			// Stops once the leader's win rate is this many standard errors ahead (0 for never)
 	float C;
 	float FPU;
-	struct teresa_tree* tree;
+	float rave;					// Visits at which AMAF & real win rates weigh the same (0 turns RAVE off)
+	float bias;					// Progressive bias: bias * prior / (1 + visits) added to UCBs (0 for none)
+	int widen;					// Progressive widening: children open at first, in prior order (0 for all)
+	int threads;				// Search threads sharing the tree (0 or 1 for single-threaded)
+	uint32_t virtual_loss;		// Losses temporarily added along a path while a thread walks it
+	teresa_parallel_mode parallel;
+	int batch;					// Playouts run from each leaf (0 or 1 for just one)
+	bool ponder;				// Keep searching on the opponent's time (see teresa_ponder_start)
+	size_t memory;				// Bytes for node arrays, split between trees (0 for TERESA_DEFAULT_MEMORY)
+	size_t tt_memory;			// Bytes for transposition tables, split the same way (0 for TERESA_DEFAULT_TT_MEMORY)
+	int profile;				// Time the phases of every this many-th iteration of each thread (0 for never)
+	struct teresa_profile* last_profile;	// Of the last search, printed to stderr after it when profiling
+	struct teresa_ponder* pondering;
+	struct teresa_tree* tree;	// Same as trees[0]
+	struct teresa_tree** trees;	// One per thread in root-parallel mode, else just one
+	int ntrees;
 	struct teresa_old_node* old_root;
+	struct teresa_ownership* ownership;
+	pattern_table* patterns;	// Trained move weights, or NULL
+	book* book;					// Moves played without searching, or NULL
+	teresa_stats stats;			// Filled in as the player goes
+	rng rng;					// Seeded on first play
+	rng profile_rng;			// Split off rng at the same time, for the profiler only
 } teresa_params;
 
+// What every Teresa of the engine starts from before command line options (5 s of playouts at 30000/s);
+// the book builder starts from it too, so books come from the engine that plays them
+#define TERESA_DEFAULT_PARAMS { \
+	.N = 150000, \
+	.C = 0.5, \
+	.FPU = 1.1, \
+	.rave = 1000, \
+	.bias = 1, \
+	.widen = 0, \
+	.threads = 1, \
+	.virtual_loss = 1, \
+	.parallel = TERESA_TREE_PARALLEL, \
+	.batch = 1, \
+}
+
 move_result teresa_play(player*, state*, move*);
 void teresa_reset(player*);
 void teresa_observe(player*, state*, color, move*);
+void teresa_estimate(player*, state*, float ownership[COUNT], float*);
+int teresa_analyze(player*, state*, move*, uint32_t*, uint32_t*);
+void teresa_get_stats(player*, teresa_stats*);
+void teresa_profile_print(FILE*, teresa_profile*);
+bool teresa_profile_dump(teresa_profile*, const char*);
+void teresa_ponder_start(player*, state*);
+void teresa_ponder_stop(player*);
+bool teresa_save(player*, state*, const char*);
+bool teresa_load(player*, state*, const char*);
 
 void g(teresa_tree*, teresa_node);
 void g2(teresa_tree*, teresa_node, const char*, int, int);
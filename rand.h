@@ -1,24 +1,83 @@
 #ifndef RAND_H
 #define RAND_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 
-// Sorry for macro function declaration ugliness; in cases where randi performance is critical, declaring a static function seems fastest
+// Random number generator context: xorshift128+ state, plus the output buffer of a MAKE_RANDI* sampler
+// Not thread-safe; give each thread its own context (see rng_split)
+// Only one MAKE_RANDI* sampler may draw from a given context, since they share the buffer
+struct rng;
+typedef struct rng {
+	uint64_t s[2];
+	uint8_t avail;
+	int outbuf[70];
+} rng;
+
+static inline uint64_t xorshift128plus(rng* r) {
+	uint64_t x = r->s[0];
+	uint64_t const y = r->s[1];
+	r->s[0] = y;
+	x ^= x << 23;
+	r->s[1] = x ^ y ^ (x >> 17) ^ (y >> 26);
+	return r->s[1] + y;
+}
+
+static inline uint64_t splitmix64(uint64_t* x) {
+	uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// Any seed is fine (state is never all zero)
+static inline void rng_seed(rng* r, uint64_t seed) {
+	r->s[0] = splitmix64(&seed);
+	r->s[1] = splitmix64(&seed);
+	if (!r->s[0] && !r->s[1]) r->s[1] = 1;
+	r->avail = 0;
+}
 
-// Initialize with two different non-zero seeds
-// uint64_t SEED1, SEED2
-#define INIT_MAKE_RANDI(SEED1, SEED2) \
-static uint64_t xorshift128plus_state[2] = {(SEED1), (SEED2)}; \
-static inline uint64_t xorshift128plus() { \
-	uint64_t x = xorshift128plus_state[0]; \
-	uint64_t const y = xorshift128plus_state[1]; \
-	xorshift128plus_state[0] = y; \
-	x ^= x << 23; \
-	xorshift128plus_state[1] = x ^ y ^ (x >> 17) ^ (y >> 26); \
-	return xorshift128plus_state[1] + y; \
+static inline bool rng_is_seeded(rng* r) {
+	return r->s[0] || r->s[1];
 }
 
+// Advance by 2^64 draws
+static inline void rng_jump(rng* r) {
+	static const uint64_t JUMP[2] = {0x8a5cd789635d2dffULL, 0x121fd2155c472f96ULL};
+	uint64_t s0 = 0;
+	uint64_t s1 = 0;
+	for (int i = 0; i < 2; ++i) {
+		for (int b = 0; b < 64; ++b) {
+			if (JUMP[i] & (1ULL << b)) {
+				s0 ^= r->s[0];
+				s1 ^= r->s[1];
+			}
+			xorshift128plus(r);
+		}
+	}
+	r->s[0] = s0;
+	r->s[1] = s1;
+	r->avail = 0;
+}
+
+// Hand the current stream to child & move parent to the next non-overlapping one
+static inline void rng_split(rng* parent, rng* child) {
+	child->s[0] = parent->s[0];
+	child->s[1] = parent->s[1];
+	child->avail = 0;
+	rng_jump(parent);
+}
+
+// Random integer from a to b-1 (multiply-shift, negligible bias for small ranges)
+static inline int rng_randi(rng* r, int a, int b) {
+	return a + (int) (((xorshift128plus(r) >> 32) * (uint64_t) (b - a)) >> 32);
+}
+
+
+// Sorry for macro function declaration ugliness; in cases where randi performance is critical, declaring a static function seems fastest
+// Generated functions take the rng* whose buffer they use
 
 // Make a function that returns a random integer from PARAM_A to PARAM_B
 // (PARAM_B - PARAM_A) < 32
@@ -27,85 +86,84 @@ static inline uint64_t xorshift128plus() { \
 // int PARAM_A
 // int PARAM_B
 #define MAKE_RANDI32(FUNCTION_NAME, PARAM_A, PARAM_B) \
-static inline int FUNCTION_NAME(void) { \
-	static int outbuf[60]; \
-	static uint8_t avail = 0; \
-	if (avail > 0) { \
-		--avail; \
-		return outbuf[avail]; \
+static inline int FUNCTION_NAME(rng* r) { \
+	int* outbuf = r->outbuf; \
+	if (r->avail > 0) { \
+		--r->avail; \
+		return outbuf[r->avail]; \
 	} \
 	const int a = (PARAM_A); \
 	const uint8_t L = (PARAM_B) - a; \
-	static uint64_t inbuf[5]; \
+	uint64_t inbuf[5]; \
 	uint8_t v; \
-	inbuf[0] = xorshift128plus(); \
-	inbuf[1] = xorshift128plus(); \
-	inbuf[2] = xorshift128plus(); \
-	inbuf[3] = xorshift128plus(); \
-	inbuf[4] = xorshift128plus(); \
+	inbuf[0] = xorshift128plus(r); \
+	inbuf[1] = xorshift128plus(r); \
+	inbuf[2] = xorshift128plus(r); \
+	inbuf[3] = xorshift128plus(r); \
+	inbuf[4] = xorshift128plus(r); \
 	const uint8_t* bf = (uint8_t*)inbuf; \
-	v = bf[0] & 0x1F;							if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[0] & 0xE0) >> 3) + (bf[1] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[1] & 0x7C) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[2] & 0x1F;							if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[2] & 0xE0) >> 3) + (bf[3] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[3] & 0x7C) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[4] & 0x1F;							if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[4] & 0xE0) >> 3) + (bf[5] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[5] & 0x7C) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[6] & 0x1F;							if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[6] & 0xE0) >> 3) + (bf[7] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[7] & 0x7C) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[8] & 0x1F;							if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[8] & 0xE0) >> 3) + (bf[9] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[9] & 0x7C) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[10] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[10] & 0xE0) >> 3) + (bf[11] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[11] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[12] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[12] & 0xE0) >> 3) + (bf[13] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[13] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[14] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[14] & 0xE0) >> 3) + (bf[15] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[15] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[16] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[16] & 0xE0) >> 3) + (bf[17] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[17] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[18] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[18] & 0xE0) >> 3) + (bf[19] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[19] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[20] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[20] & 0xE0) >> 3) + (bf[21] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[21] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[22] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[22] & 0xE0) >> 3) + (bf[23] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[23] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[24] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[24] & 0xE0) >> 3) + (bf[25] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[25] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[26] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[26] & 0xE0) >> 3) + (bf[27] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[27] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[28] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[28] & 0xE0) >> 3) + (bf[29] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[29] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[30] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[30] & 0xE0) >> 3) + (bf[31] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[31] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[32] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[32] & 0xE0) >> 3) + (bf[33] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[33] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[34] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[34] & 0xE0) >> 3) + (bf[35] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[35] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[36] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[36] & 0xE0) >> 3) + (bf[37] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[37] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[38] & 0x1F;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[38] & 0xE0) >> 3) + (bf[39] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[39] & 0x7C) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	--avail; \
-	return outbuf[avail]; \
+	v = bf[0] & 0x1F;							if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[0] & 0xE0) >> 3) + (bf[1] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[1] & 0x7C) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[2] & 0x1F;							if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[2] & 0xE0) >> 3) + (bf[3] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[3] & 0x7C) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[4] & 0x1F;							if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[4] & 0xE0) >> 3) + (bf[5] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[5] & 0x7C) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[6] & 0x1F;							if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[6] & 0xE0) >> 3) + (bf[7] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[7] & 0x7C) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[8] & 0x1F;							if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[8] & 0xE0) >> 3) + (bf[9] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[9] & 0x7C) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[10] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[10] & 0xE0) >> 3) + (bf[11] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[11] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[12] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[12] & 0xE0) >> 3) + (bf[13] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[13] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[14] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[14] & 0xE0) >> 3) + (bf[15] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[15] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[16] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[16] & 0xE0) >> 3) + (bf[17] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[17] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[18] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[18] & 0xE0) >> 3) + (bf[19] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[19] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[20] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[20] & 0xE0) >> 3) + (bf[21] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[21] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[22] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[22] & 0xE0) >> 3) + (bf[23] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[23] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[24] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[24] & 0xE0) >> 3) + (bf[25] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[25] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[26] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[26] & 0xE0) >> 3) + (bf[27] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[27] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[28] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[28] & 0xE0) >> 3) + (bf[29] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[29] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[30] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[30] & 0xE0) >> 3) + (bf[31] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[31] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[32] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[32] & 0xE0) >> 3) + (bf[33] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[33] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[34] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[34] & 0xE0) >> 3) + (bf[35] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[35] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[36] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[36] & 0xE0) >> 3) + (bf[37] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[37] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[38] & 0x1F;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[38] & 0xE0) >> 3) + (bf[39] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[39] & 0x7C) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	--r->avail; \
+	return outbuf[r->avail]; \
 }
 
 
@@ -121,80 +179,79 @@ static inline int FUNCTION_NAME(void) { \
 // int PARAM_A
 // int PARAM_B
 #define MAKE_RANDI128(FUNCTION_NAME, PARAM_A, PARAM_B) \
-static inline int FUNCTION_NAME(void) { \
-	static int outbuf[54]; \
-	static uint8_t avail = 0; \
-	if (avail > 0) { \
-		--avail; \
-		return outbuf[avail]; \
+static inline int FUNCTION_NAME(rng* r) { \
+	int* outbuf = r->outbuf; \
+	if (r->avail > 0) { \
+		--r->avail; \
+		return outbuf[r->avail]; \
 	} \
 	const int a = (PARAM_A); \
 	const uint8_t L = (PARAM_B) - a; \
-	static uint64_t inbuf[7]; \
+	uint64_t inbuf[7]; \
 	uint8_t v; \
-	inbuf[0] = xorshift128plus(); \
-	inbuf[1] = xorshift128plus(); \
-	inbuf[2] = xorshift128plus(); \
-	inbuf[3] = xorshift128plus(); \
-	inbuf[4] = xorshift128plus(); \
-	inbuf[5] = xorshift128plus(); \
+	inbuf[0] = xorshift128plus(r); \
+	inbuf[1] = xorshift128plus(r); \
+	inbuf[2] = xorshift128plus(r); \
+	inbuf[3] = xorshift128plus(r); \
+	inbuf[4] = xorshift128plus(r); \
+	inbuf[5] = xorshift128plus(r); \
 	const uint8_t* bf = (uint8_t*)inbuf; \
-	v = bf[0] & 0x7f;							if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[0] & 0x80) >> 1) + (bf[1] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[1] & 0xc0) >> 1) + (bf[2] & 0x1f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[2] & 0xe0) >> 1) + (bf[3] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[3] & 0xf0) >> 1) + (bf[4] & 0x07);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[4] & 0xf8) >> 1) + (bf[5] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[5] & 0xfc) >> 1) + (bf[6] & 0x01);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[6] & 0xfe) >> 1);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[7] & 0x7f;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[7] & 0x80) >> 1) + (bf[8] & 0x3f);		if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[8] & 0xc0) >> 1) + (bf[9] & 0x1f);		if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[9] & 0xe0) >> 1) + (bf[10] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[10] & 0xf0) >> 1) + (bf[11] & 0x07);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[11] & 0xf8) >> 1) + (bf[12] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[12] & 0xfc) >> 1) + (bf[13] & 0x01);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[13] & 0xfe) >> 1);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[14] & 0x7f;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[14] & 0x80) >> 1) + (bf[15] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[15] & 0xc0) >> 1) + (bf[16] & 0x1f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[16] & 0xe0) >> 1) + (bf[17] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[17] & 0xf0) >> 1) + (bf[18] & 0x07);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[18] & 0xf8) >> 1) + (bf[19] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[19] & 0xfc) >> 1) + (bf[20] & 0x01);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[20] & 0xfe) >> 1);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[21] & 0x7f;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[21] & 0x80) >> 1) + (bf[22] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[22] & 0xc0) >> 1) + (bf[23] & 0x1f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[23] & 0xe0) >> 1) + (bf[24] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[24] & 0xf0) >> 1) + (bf[25] & 0x07);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[25] & 0xf8) >> 1) + (bf[26] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[26] & 0xfc) >> 1) + (bf[27] & 0x01);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[27] & 0xfe) >> 1);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[28] & 0x7f;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[28] & 0x80) >> 1) + (bf[29] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[29] & 0xc0) >> 1) + (bf[30] & 0x1f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[30] & 0xe0) >> 1) + (bf[31] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[31] & 0xf0) >> 1) + (bf[32] & 0x07);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[32] & 0xf8) >> 1) + (bf[33] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[33] & 0xfc) >> 1) + (bf[34] & 0x01);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[34] & 0xfe) >> 1);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[35] & 0x7f;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[35] & 0x80) >> 1) + (bf[36] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[36] & 0xc0) >> 1) + (bf[37] & 0x1f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[37] & 0xe0) >> 1) + (bf[38] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[38] & 0xf0) >> 1) + (bf[39] & 0x07);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[39] & 0xf8) >> 1) + (bf[40] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[40] & 0xfc) >> 1) + (bf[41] & 0x01);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[41] & 0xfe) >> 1);						if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[42] & 0x7f;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[42] & 0x80) >> 1) + (bf[43] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[43] & 0xc0) >> 1) + (bf[44] & 0x1f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[44] & 0xe0) >> 1) + (bf[45] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[45] & 0xf0) >> 1) + (bf[46] & 0x07);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[46] & 0xf8) >> 1) + (bf[47] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	--avail; \
-	return outbuf[avail]; \
+	v = bf[0] & 0x7f;							if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[0] & 0x80) >> 1) + (bf[1] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[1] & 0xc0) >> 1) + (bf[2] & 0x1f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[2] & 0xe0) >> 1) + (bf[3] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[3] & 0xf0) >> 1) + (bf[4] & 0x07);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[4] & 0xf8) >> 1) + (bf[5] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[5] & 0xfc) >> 1) + (bf[6] & 0x01);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[6] & 0xfe) >> 1);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[7] & 0x7f;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[7] & 0x80) >> 1) + (bf[8] & 0x3f);		if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[8] & 0xc0) >> 1) + (bf[9] & 0x1f);		if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[9] & 0xe0) >> 1) + (bf[10] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[10] & 0xf0) >> 1) + (bf[11] & 0x07);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[11] & 0xf8) >> 1) + (bf[12] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[12] & 0xfc) >> 1) + (bf[13] & 0x01);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[13] & 0xfe) >> 1);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[14] & 0x7f;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[14] & 0x80) >> 1) + (bf[15] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[15] & 0xc0) >> 1) + (bf[16] & 0x1f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[16] & 0xe0) >> 1) + (bf[17] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[17] & 0xf0) >> 1) + (bf[18] & 0x07);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[18] & 0xf8) >> 1) + (bf[19] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[19] & 0xfc) >> 1) + (bf[20] & 0x01);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[20] & 0xfe) >> 1);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[21] & 0x7f;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[21] & 0x80) >> 1) + (bf[22] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[22] & 0xc0) >> 1) + (bf[23] & 0x1f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[23] & 0xe0) >> 1) + (bf[24] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[24] & 0xf0) >> 1) + (bf[25] & 0x07);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[25] & 0xf8) >> 1) + (bf[26] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[26] & 0xfc) >> 1) + (bf[27] & 0x01);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[27] & 0xfe) >> 1);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[28] & 0x7f;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[28] & 0x80) >> 1) + (bf[29] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[29] & 0xc0) >> 1) + (bf[30] & 0x1f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[30] & 0xe0) >> 1) + (bf[31] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[31] & 0xf0) >> 1) + (bf[32] & 0x07);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[32] & 0xf8) >> 1) + (bf[33] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[33] & 0xfc) >> 1) + (bf[34] & 0x01);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[34] & 0xfe) >> 1);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[35] & 0x7f;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[35] & 0x80) >> 1) + (bf[36] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[36] & 0xc0) >> 1) + (bf[37] & 0x1f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[37] & 0xe0) >> 1) + (bf[38] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[38] & 0xf0) >> 1) + (bf[39] & 0x07);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[39] & 0xf8) >> 1) + (bf[40] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[40] & 0xfc) >> 1) + (bf[41] & 0x01);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[41] & 0xfe) >> 1);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[42] & 0x7f;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[42] & 0x80) >> 1) + (bf[43] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[43] & 0xc0) >> 1) + (bf[44] & 0x1f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[44] & 0xe0) >> 1) + (bf[45] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[45] & 0xf0) >> 1) + (bf[46] & 0x07);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[46] & 0xf8) >> 1) + (bf[47] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	--r->avail; \
+	return outbuf[r->avail]; \
 }
 
 
@@ -210,100 +267,99 @@ static inline int FUNCTION_NAME(void) { \
 // int PARAM_A
 // int PARAM_B
 #define MAKE_RANDI512(FUNCTION_NAME, PARAM_A, PARAM_B) \
-static inline int FUNCTION_NAME(void) { \
-	static int outbuf[70]; \
-	static uint8_t avail = 0; \
-	if (avail > 0) { \
-		--avail; \
-		return outbuf[avail]; \
+static inline int FUNCTION_NAME(rng* r) { \
+	int* outbuf = r->outbuf; \
+	if (r->avail > 0) { \
+		--r->avail; \
+		return outbuf[r->avail]; \
 	} \
 	const int a = (PARAM_A); \
 	const uint16_t L = (PARAM_B) - a; \
-	static uint64_t inbuf[10]; \
+	uint64_t inbuf[10]; \
 	uint16_t v; \
-	inbuf[0] = xorshift128plus(); \
-	inbuf[1] = xorshift128plus(); \
-	inbuf[2] = xorshift128plus(); \
-	inbuf[3] = xorshift128plus(); \
-	inbuf[4] = xorshift128plus(); \
-	inbuf[5] = xorshift128plus(); \
-	inbuf[6] = xorshift128plus(); \
-	inbuf[7] = xorshift128plus(); \
-	inbuf[8] = xorshift128plus(); \
-	inbuf[9] = xorshift128plus(); \
+	inbuf[0] = xorshift128plus(r); \
+	inbuf[1] = xorshift128plus(r); \
+	inbuf[2] = xorshift128plus(r); \
+	inbuf[3] = xorshift128plus(r); \
+	inbuf[4] = xorshift128plus(r); \
+	inbuf[5] = xorshift128plus(r); \
+	inbuf[6] = xorshift128plus(r); \
+	inbuf[7] = xorshift128plus(r); \
+	inbuf[8] = xorshift128plus(r); \
+	inbuf[9] = xorshift128plus(r); \
 	const uint16_t* bf = (uint16_t*)inbuf; \
-	v = bf[0] & 0x1ff;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[0] & 0xfe00) >> 7) + (bf[1] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[1] & 0x7fc) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[1] & 0xf800) >> 7) + (bf[2] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[2] & 0x1ff0) >> 4);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[2] & 0xe000) >> 7) + (bf[3] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[3] & 0x7fc0) >> 6);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[4] & 0x1ff;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[4] & 0xfe00) >> 7) + (bf[5] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[5] & 0x7fc) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[5] & 0xf800) >> 7) + (bf[6] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[6] & 0x1ff0) >> 4);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[6] & 0xe000) >> 7) + (bf[7] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[7] & 0x7fc0) >> 6);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[8] & 0x1ff;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[8] & 0xfe00) >> 7) + (bf[9] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[9] & 0x7fc) >> 2);						if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[9] & 0xf800) >> 7) + (bf[10] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[10] & 0x1ff0) >> 4);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[10] & 0xe000) >> 7) + (bf[11] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[11] & 0x7fc0) >> 6);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[12] & 0x1ff;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[12] & 0xfe00) >> 7) + (bf[13] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[13] & 0x7fc) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[13] & 0xf800) >> 7) + (bf[14] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[14] & 0x1ff0) >> 4);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[14] & 0xe000) >> 7) + (bf[15] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[15] & 0x7fc0) >> 6);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[16] & 0x1ff;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[16] & 0xfe00) >> 7) + (bf[17] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[17] & 0x7fc) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[17] & 0xf800) >> 7) + (bf[18] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[18] & 0x1ff0) >> 4);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[18] & 0xe000) >> 7) + (bf[19] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[19] & 0x7fc0) >> 6);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[20] & 0x1ff;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[20] & 0xfe00) >> 7) + (bf[21] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[21] & 0x7fc) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[21] & 0xf800) >> 7) + (bf[22] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[22] & 0x1ff0) >> 4);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[22] & 0xe000) >> 7) + (bf[23] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[23] & 0x7fc0) >> 6);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[24] & 0x1ff;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[24] & 0xfe00) >> 7) + (bf[25] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[25] & 0x7fc) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[25] & 0xf800) >> 7) + (bf[26] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[26] & 0x1ff0) >> 4);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[26] & 0xe000) >> 7) + (bf[27] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[27] & 0x7fc0) >> 6);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[28] & 0x1ff;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[28] & 0xfe00) >> 7) + (bf[29] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[29] & 0x7fc) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[29] & 0xf800) >> 7) + (bf[30] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[30] & 0x1ff0) >> 4);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[30] & 0xe000) >> 7) + (bf[31] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[31] & 0x7fc0) >> 6);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[32] & 0x1ff;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[32] & 0xfe00) >> 7) + (bf[33] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[33] & 0x7fc) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[33] & 0xf800) >> 7) + (bf[34] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[34] & 0x1ff0) >> 4);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[34] & 0xe000) >> 7) + (bf[35] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[35] & 0x7fc0) >> 6);					if (v <= L) outbuf[avail++] = v + a; \
-	v = bf[36] & 0x1ff;								if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[36] & 0xfe00) >> 7) + (bf[37] & 0x03);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[37] & 0x7fc) >> 2);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[37] & 0xf800) >> 7) + (bf[38] & 0x0f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[38] & 0x1ff0) >> 4);					if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[38] & 0xe000) >> 7) + (bf[39] & 0x3f);	if (v <= L) outbuf[avail++] = v + a; \
-	v = ((bf[39] & 0x7fc0) >> 6);					if (v <= L) outbuf[avail++] = v + a; \
-	--avail; \
-	return outbuf[avail]; \
+	v = bf[0] & 0x1ff;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[0] & 0xfe00) >> 7) + (bf[1] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[1] & 0x7fc) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[1] & 0xf800) >> 7) + (bf[2] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[2] & 0x1ff0) >> 4);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[2] & 0xe000) >> 7) + (bf[3] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[3] & 0x7fc0) >> 6);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[4] & 0x1ff;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[4] & 0xfe00) >> 7) + (bf[5] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[5] & 0x7fc) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[5] & 0xf800) >> 7) + (bf[6] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[6] & 0x1ff0) >> 4);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[6] & 0xe000) >> 7) + (bf[7] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[7] & 0x7fc0) >> 6);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[8] & 0x1ff;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[8] & 0xfe00) >> 7) + (bf[9] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[9] & 0x7fc) >> 2);						if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[9] & 0xf800) >> 7) + (bf[10] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[10] & 0x1ff0) >> 4);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[10] & 0xe000) >> 7) + (bf[11] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[11] & 0x7fc0) >> 6);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[12] & 0x1ff;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[12] & 0xfe00) >> 7) + (bf[13] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[13] & 0x7fc) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[13] & 0xf800) >> 7) + (bf[14] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[14] & 0x1ff0) >> 4);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[14] & 0xe000) >> 7) + (bf[15] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[15] & 0x7fc0) >> 6);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[16] & 0x1ff;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[16] & 0xfe00) >> 7) + (bf[17] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[17] & 0x7fc) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[17] & 0xf800) >> 7) + (bf[18] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[18] & 0x1ff0) >> 4);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[18] & 0xe000) >> 7) + (bf[19] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[19] & 0x7fc0) >> 6);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[20] & 0x1ff;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[20] & 0xfe00) >> 7) + (bf[21] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[21] & 0x7fc) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[21] & 0xf800) >> 7) + (bf[22] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[22] & 0x1ff0) >> 4);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[22] & 0xe000) >> 7) + (bf[23] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[23] & 0x7fc0) >> 6);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[24] & 0x1ff;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[24] & 0xfe00) >> 7) + (bf[25] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[25] & 0x7fc) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[25] & 0xf800) >> 7) + (bf[26] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[26] & 0x1ff0) >> 4);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[26] & 0xe000) >> 7) + (bf[27] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[27] & 0x7fc0) >> 6);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[28] & 0x1ff;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[28] & 0xfe00) >> 7) + (bf[29] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[29] & 0x7fc) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[29] & 0xf800) >> 7) + (bf[30] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[30] & 0x1ff0) >> 4);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[30] & 0xe000) >> 7) + (bf[31] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[31] & 0x7fc0) >> 6);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[32] & 0x1ff;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[32] & 0xfe00) >> 7) + (bf[33] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[33] & 0x7fc) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[33] & 0xf800) >> 7) + (bf[34] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[34] & 0x1ff0) >> 4);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[34] & 0xe000) >> 7) + (bf[35] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[35] & 0x7fc0) >> 6);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = bf[36] & 0x1ff;								if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[36] & 0xfe00) >> 7) + (bf[37] & 0x03);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[37] & 0x7fc) >> 2);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[37] & 0xf800) >> 7) + (bf[38] & 0x0f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[38] & 0x1ff0) >> 4);					if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[38] & 0xe000) >> 7) + (bf[39] & 0x3f);	if (v <= L) outbuf[r->avail++] = v + a; \
+	v = ((bf[39] & 0x7fc0) >> 6);					if (v <= L) outbuf[r->avail++] = v + a; \
+	--r->avail; \
+	return outbuf[r->avail]; \
 }
 
 
@@ -0,0 +1,84 @@
+#include "timeman.h"
+#include "utils.h"
+
+void timeman_settings(time_control* tc, double main_time, double byo_time, int byo_stones) {
+	// GTP: byo-yomi time > 0 with 0 stones means no time limit at all
+	tc->enabled = !(byo_time > 0 && byo_stones == 0);
+
+	// Periods of no time are no byo-yomi: main time is all there is (sudden death)
+	if (byo_time <= 0) {
+		byo_stones = 0;
+	}
+
+	tc->main_time = main_time;
+	tc->byo_time = byo_time;
+	tc->byo_stones = byo_stones;
+	tc->left = main_time;
+	tc->stones_left = 0;
+
+	if (main_time <= 0 && byo_stones > 0) {
+		tc->left = byo_time;
+		tc->stones_left = byo_stones;
+	}
+}
+
+void timeman_left(time_control* tc, double left, int stones_left) {
+	tc->left = left;
+	tc->stones_left = stones_left;
+}
+
+// Keep the clock running between time_left updates
+void timeman_spend(time_control* tc, double elapsed) {
+	if (!tc->enabled) return;
+
+	tc->left -= elapsed;
+
+	if (tc->stones_left > 0) {
+		if (--tc->stones_left == 0) {
+			// Period done in time, next one starts afresh
+			tc->left = tc->byo_time;
+			tc->stones_left = tc->byo_stones;
+		}
+	} else if (tc->left <= 0 && tc->byo_stones > 0) {
+		// Main time just ran out
+		tc->left = tc->byo_time;
+		tc->stones_left = tc->byo_stones;
+	}
+}
+
+// Moves we still expect to play: about a third of the empty points on a 9x9
+static int timeman_moves_left(state* st) {
+	int empty = 0;
+	for (int i = 0; i < COUNT; ++i) {
+		empty += (st->board[i].player == EMPTY);
+	}
+	return max(empty / 3, TIMEMAN_MIN_MOVES_LEFT);
+}
+
+// Seconds to think for the next move: search may stop after soft if the choice is clear, must stop by hard
+// Both are 0 without time control
+void timeman_budget(time_control* tc, state* st, double* soft, double* hard) {
+	*soft = *hard = 0;
+	if (!tc->enabled) return;
+
+	double left = tc->left - TIMEMAN_SAFETY;
+
+	if (tc->stones_left > 0) {
+		// Byo-yomi: spread the period evenly over its stones
+		double per_stone = left / tc->stones_left;
+		*soft = 0.8 * per_stone;
+		*hard = per_stone;
+	} else {
+		// Main time: share it over the rest of the game, plus one byo-yomi stone if there is one
+		double extra = (tc->byo_stones > 0) ? 0.8 * tc->byo_time / tc->byo_stones : 0;
+		*soft = left / timeman_moves_left(st) + extra;
+		*hard = TIMEMAN_HARD_FACTOR * *soft;
+		if (*hard > 0.5 * left + extra) {
+			*hard = 0.5 * left + extra;
+		}
+	}
+
+	// Out of time still plays fast rather than falling back to no time control (soft of 0)
+	if (*hard < 0.05) *hard = 0.05;
+	if (*soft < 0.05 || *soft > *hard) *soft = *hard;
+}
@@ -0,0 +1,35 @@
+#ifndef TIMEMAN_H
+#define TIMEMAN_H
+
+#include <stdbool.h>
+#include "go.h"
+
+// Kept back on every move for lag & process overhead (s)
+#define TIMEMAN_SAFETY 0.3
+
+// Never plan for fewer of our own moves than this while in main time
+#define TIMEMAN_MIN_MOVES_LEFT 10
+
+// Hard limit is at most this many soft budgets
+#define TIMEMAN_HARD_FACTOR 3.0
+
+// One player's clock, as set by GTP time_settings (Canadian byo-yomi) & time_left
+// No time control until settings are given; byo_stones == 0 means no byo-yomi
+typedef struct {
+	bool enabled;
+	double main_time;	// s
+	double byo_time;	// s per byo-yomi period
+	int byo_stones;		// Stones to play in each period
+	double left;		// s left in main time, or in the current period once in byo-yomi
+	int stones_left;	// Stones left in the current period; 0 while in main time
+} time_control;
+
+void timeman_settings(time_control*, double main_time, double byo_time, int byo_stones);
+
+void timeman_left(time_control*, double left, int stones_left);
+
+void timeman_spend(time_control*, double elapsed);
+
+void timeman_budget(time_control*, state*, double* soft, double* hard);
+
+#endif
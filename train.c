@@ -0,0 +1,449 @@
+#include <locale.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <wchar.h>
+#include "go.h"
+#include "patterns.h"
+#include "utils.h"
+
+/*
+Offline pattern weight training
+
+Usage: train.x [-j threads] [-i iterations] [-o weights.bin] [-T spill dir] games.sgf...
+
+Replays the main line of every game in the given SGF files (collections are
+fine, files are streamed), and at every move records the pattern features of
+each legal move. Each position is a competition won by the move actually
+played; weights are fitted to a generalized Bradley-Terry model with teams
+{3x3 pattern, large pattern} using Hunter's minorization-maximization
+updates (one virtual win & loss against a gamma of 1 as prior).
+
+Files are split across threads while parsing; each thread spills its
+positions to an unlinked file of its own (in the spill dir, else wherever
+tmpfile puts them) & streams it back on every pass while fitting, so memory
+use does not grow with the corpus, only the spill files do.
+Weights are written in the format loaded by patterns_load.
+*/
+
+#define SGF_VALUE_MAX 256
+// Stdio buffer of each spill file
+#define SPILL_BUFFER (1 << 20)
+
+// Spilled position: this, then count uint16_t 3x3 ids & count uint32_t large ids
+typedef struct {
+	uint16_t count;
+	uint16_t winner;	// Index of the move played among the candidates
+} train_record;
+
+// Positions recorded by one parsing thread
+typedef struct {
+	FILE* spill;
+	char* buffer;
+	uint64_t ncand;
+	uint64_t npos;
+	uint64_t ngames;
+} train_data;
+
+typedef struct {
+	char** files;
+	int nfiles;
+	int next_file;	// Shared, taken atomically
+} train_files;
+
+typedef struct {
+	train_files* files;
+	train_data data;
+} parse_job;
+
+// Fits over the positions a parsing thread spilled
+typedef struct {
+	train_data* data;
+	int group;		// 0: update 3x3 weights, 1: update large weights
+	double* denom;
+	double loglik;
+} fit_job;
+
+static float gamma_3x3[PATTERN_3X3_COUNT];
+static float gamma_large[PATTERN_LARGE_COUNT];
+static uint64_t wins_3x3[PATTERN_3X3_COUNT];	// Summed atomically by parsing threads
+static uint64_t wins_large[PATTERN_LARGE_COUNT];
+
+static void* xrealloc(void* ptr, size_t size) {
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		fwprintf(stderr, L"E: out of memory\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+// Unlinked scratch file in dir (or tmpfile's choice), gone once closed
+static FILE* spill_open(const char* dir) {
+	FILE* f = NULL;
+	if (dir) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/train.XXXXXX", dir);
+		int fd = mkstemp(path);
+		if (fd >= 0) {
+			unlink(path);
+			f = fdopen(fd, "w+b");
+		}
+	} else {
+		f = tmpfile();
+	}
+	return f;
+}
+
+static void spill_write(train_data* data, const void* ptr, size_t size, size_t n) {
+	if (fwrite(ptr, size, n, data->spill) != n) {
+		fwprintf(stderr, L"E: could not write spill file\n");
+		exit(1);
+	}
+}
+
+static void train_data_push_position(train_data* data, state* st, move played) {
+	move list[NMOVES];
+	int n = 0;
+	int winner = -1;
+	for (move mv = 0; mv < COUNT; ++mv) {
+		if (go_is_move_legal(st, &mv)) {
+			if (mv == played) winner = n;
+			list[n++] = mv;
+		}
+	}
+
+	if (winner < 0 || n < 2) {
+		return;
+	}
+
+	uint16_t p3[NMOVES];
+	uint32_t plarge[NMOVES];
+	for (int k = 0; k < n; ++k) {
+		pattern_features(st, list[k], &p3[k], &plarge[k]);
+	}
+
+	train_record record = {n, winner};
+	spill_write(data, &record, sizeof(record), 1);
+	spill_write(data, p3, sizeof(uint16_t), n);
+	spill_write(data, plarge, sizeof(uint32_t), n);
+
+	__atomic_fetch_add(&wins_3x3[p3[winner]], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&wins_large[plarge[winner]], 1, __ATOMIC_RELAXED);
+	++data->npos;
+	data->ncand += n;
+}
+
+// SGF point "ab" (column, row) to move; "" and "tt" are passes
+static bool sgf_parse_move(const char* value, move* mv) {
+	if (value[0] == '\0' || (WIDTH <= 19 && strcmp(value, "tt") == 0)) {
+		*mv = MOVE_PASS;
+		return true;
+	}
+
+	if (value[1] == '\0') return false;
+
+	int j = value[0] - 'a';
+	int i = value[1] - 'a';
+	if (i < 0 || i >= HEIGHT || j < 0 || j >= WIDTH) return false;
+
+	*mv = i * WIDTH + j;
+	return true;
+}
+
+// Returns false once the game can't be used any further
+static bool sgf_property(train_data* data, state* st, const char* ident, const char* value) {
+	move mv;
+
+	if (strcmp(ident, "SZ") == 0) {
+		return atoi(value) == WIDTH && WIDTH == HEIGHT;
+	} else if (strcmp(ident, "AB") == 0 || strcmp(ident, "AW") == 0) {
+		if (!sgf_parse_move(value, &mv) || mv < 0) return false;
+		color next = st->nextPlayer;
+		st->nextPlayer = (ident[1] == 'B') ? BLACK : WHITE;
+		bool ok = go_play_move(st, &mv) == SUCCESS;
+		st->nextPlayer = (ident[1] == 'B') ? WHITE : next;
+		return ok;
+	} else if (strcmp(ident, "B") == 0 || strcmp(ident, "W") == 0) {
+		if (!sgf_parse_move(value, &mv)) return false;
+		st->nextPlayer = (ident[0] == 'B') ? BLACK : WHITE;
+		if (mv >= 0) {
+			train_data_push_position(data, st, mv);
+		}
+		return go_play_move(st, &mv) == SUCCESS;
+	}
+
+	return true;
+}
+
+// Streams a file game by game; only the main line of each game is replayed
+static void sgf_parse_file(FILE* f, train_data* data) {
+	state* st = NULL;
+	int depth = 0;
+	bool usable = false;
+	bool mainline_done = false;
+
+	char ident[8];
+	char value[SGF_VALUE_MAX];
+
+	int c = getc(f);
+	while (c != EOF) {
+		if (c == '(') {
+			if (++depth == 1) {
+				if (st) state_destroy(st);
+				st = state_create();
+				usable = true;
+				mainline_done = false;
+			}
+		} else if (c == ')') {
+			if (depth >= 2) {
+				// Variations after the first closed one are not main line
+				mainline_done = true;
+			}
+			if (depth > 0 && --depth == 0 && usable) {
+				++data->ngames;
+			}
+		} else if (c >= 'A' && c <= 'Z') {
+			int n = 0;
+			while ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) {
+				if (c <= 'Z' && n < (int) sizeof(ident) - 1) ident[n++] = c;
+				c = getc(f);
+			}
+			ident[n] = '\0';
+
+			while (c == ' ' || c == '\n' || c == '\r' || c == '\t') c = getc(f);
+
+			while (c == '[') {
+				n = 0;
+				c = getc(f);
+				while (c != EOF && c != ']') {
+					if (c == '\\') c = getc(f);
+					if (c != EOF && n < SGF_VALUE_MAX - 1) value[n++] = c;
+					c = getc(f);
+				}
+				value[n] = '\0';
+
+				if (depth >= 1 && usable && !mainline_done) {
+					usable = sgf_property(data, st, ident, value);
+				}
+
+				c = getc(f);
+				while (c == ' ' || c == '\n' || c == '\r' || c == '\t') c = getc(f);
+			}
+			continue;	// c already holds the next character
+		}
+
+		c = getc(f);
+	}
+
+	if (st) state_destroy(st);
+}
+
+static void* parse_worker(void* arg) {
+	parse_job* job = arg;
+	train_files* files = job->files;
+
+	while (true) {
+		int k = __atomic_fetch_add(&files->next_file, 1, __ATOMIC_RELAXED);
+		if (k >= files->nfiles) break;
+
+		FILE* f = fopen(files->files[k], "r");
+		if (!f) {
+			fwprintf(stderr, L"W: could not open %s\n", files->files[k]);
+			continue;
+		}
+		sgf_parse_file(f, &job->data);
+		fclose(f);
+	}
+
+	return NULL;
+}
+
+// Sum over competitions of (strength of teammates / strength of all teams), per feature
+static void* fit_worker(void* arg) {
+	fit_job* job = arg;
+	train_data* data = job->data;
+
+	rewind(data->spill);
+
+	double loglik = 0;
+	train_record record;
+	uint16_t p3[NMOVES];
+	uint32_t plarge[NMOVES];
+	for (uint64_t pos = 0; pos < data->npos; ++pos) {
+		if (fread(&record, sizeof(record), 1, data->spill) != 1
+			|| fread(p3, sizeof(uint16_t), record.count, data->spill) != record.count
+			|| fread(plarge, sizeof(uint32_t), record.count, data->spill) != record.count) {
+			fwprintf(stderr, L"E: could not read spill file\n");
+			exit(1);
+		}
+		int n = record.count;
+
+		double E = 0;
+		for (int k = 0; k < n; ++k) {
+			E += (double) gamma_3x3[p3[k]] * gamma_large[plarge[k]];
+		}
+
+		if (job->group == 0) {
+			for (int k = 0; k < n; ++k) {
+				job->denom[p3[k]] += gamma_large[plarge[k]] / E;
+			}
+		} else {
+			for (int k = 0; k < n; ++k) {
+				job->denom[plarge[k]] += gamma_3x3[p3[k]] / E;
+			}
+		}
+
+		int w = record.winner;
+		loglik += log((double) gamma_3x3[p3[w]] * gamma_large[plarge[w]] / E);
+	}
+
+	job->loglik = loglik;
+	return NULL;
+}
+
+// One MM update of a group of weights, one thread per spill file; returns log-likelihood before the update
+static double fit_group(parse_job* parts, int group, int nthreads) {
+	size_t nfeatures = (group == 0) ? PATTERN_3X3_COUNT : PATTERN_LARGE_COUNT;
+	float* gamma = (group == 0) ? gamma_3x3 : gamma_large;
+	uint64_t* wins = (group == 0) ? wins_3x3 : wins_large;
+
+	fit_job jobs[nthreads];
+	pthread_t threads[nthreads];
+	for (int t = 0; t < nthreads; ++t) {
+		jobs[t].data = &parts[t].data;
+		jobs[t].group = group;
+		jobs[t].denom = xrealloc(NULL, nfeatures * sizeof(double));
+		memset(jobs[t].denom, 0, nfeatures * sizeof(double));
+		pthread_create(&threads[t], NULL, fit_worker, &jobs[t]);
+	}
+
+	double loglik = 0;
+	for (int t = 0; t < nthreads; ++t) {
+		pthread_join(threads[t], NULL);
+		loglik += jobs[t].loglik;
+	}
+
+	for (size_t i = 0; i < nfeatures; ++i) {
+		double denom = 0;
+		for (int t = 0; t < nthreads; ++t) {
+			denom += jobs[t].denom[i];
+		}
+		if (denom > 0 || wins[i]) {
+			gamma[i] = (wins[i] + 1.0) / (denom + 2.0 / (gamma[i] + 1.0));
+		}
+	}
+
+	for (int t = 0; t < nthreads; ++t) {
+		free(jobs[t].denom);
+	}
+
+	return loglik;
+}
+
+int main(int argc, char* argv[]) {
+	setlocale(LC_ALL, "");
+	patterns_init();
+
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int iterations = 20;
+	const char* out_path = "patterns.bin";
+	const char* spill_dir = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "j:i:o:T:")) != -1) {
+		switch (opt) {
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'i':
+				iterations = atoi(optarg);
+				break;
+			case 'o':
+				out_path = optarg;
+				break;
+			case 'T':
+				spill_dir = optarg;
+				break;
+			default:
+				fwprintf(stderr, L"Usage: %s [-j threads] [-i iterations] [-o weights.bin] [-T spill dir] games.sgf...\n", argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind >= argc || nthreads < 1 || iterations < 0) {
+		fwprintf(stderr, L"Usage: %s [-j threads] [-i iterations] [-o weights.bin] [-T spill dir] games.sgf...\n", argv[0]);
+		return 1;
+	}
+
+	// Extract features
+	uint64_t t0 = timer_now();
+
+	train_files files = {argv + optind, argc - optind, 0};
+	parse_job jobs[nthreads];
+	pthread_t threads[nthreads];
+	for (int t = 0; t < nthreads; ++t) {
+		jobs[t].files = &files;
+		memset(&jobs[t].data, 0, sizeof(train_data));
+		jobs[t].data.spill = spill_open(spill_dir);
+		jobs[t].data.buffer = xrealloc(NULL, SPILL_BUFFER);
+		if (!jobs[t].data.spill) {
+			fwprintf(stderr, L"E: could not create spill file\n");
+			return 1;
+		}
+		setvbuf(jobs[t].data.spill, jobs[t].data.buffer, _IOFBF, SPILL_BUFFER);
+	}
+	for (int t = 0; t < nthreads; ++t) {
+		pthread_create(&threads[t], NULL, parse_worker, &jobs[t]);
+	}
+
+	uint64_t ngames = 0;
+	uint64_t npos = 0;
+	uint64_t ncand = 0;
+	for (int t = 0; t < nthreads; ++t) {
+		pthread_join(threads[t], NULL);
+		if (fflush(jobs[t].data.spill) != 0) {
+			fwprintf(stderr, L"E: could not write spill file\n");
+			return 1;
+		}
+		ngames += jobs[t].data.ngames;
+		npos += jobs[t].data.npos;
+		ncand += jobs[t].data.ncand;
+	}
+
+	fwprintf(stderr, L"%d files, %llu games, %llu positions, %llu candidates [%.1f s]\n",
+		files.nfiles, (unsigned long long) ngames, (unsigned long long) npos, (unsigned long long) ncand,
+		(timer_now() - t0)/1e9);
+
+	if (!npos) {
+		fwprintf(stderr, L"E: no usable positions\n");
+		return 1;
+	}
+
+	// Fit weights
+	for (size_t i = 0; i < PATTERN_3X3_COUNT; ++i) gamma_3x3[i] = 1.0;
+	for (size_t i = 0; i < PATTERN_LARGE_COUNT; ++i) gamma_large[i] = 1.0;
+
+	for (int it = 0; it < iterations; ++it) {
+		double loglik = fit_group(jobs, 0, nthreads);
+		fit_group(jobs, 1, nthreads);
+		fwprintf(stderr, L"Iteration %d: mean log-likelihood %.4f\n", it + 1, loglik / npos);
+	}
+
+	for (int t = 0; t < nthreads; ++t) {
+		fclose(jobs[t].data.spill);
+		free(jobs[t].data.buffer);
+	}
+
+	if (!patterns_save(out_path, gamma_3x3, gamma_large)) {
+		fwprintf(stderr, L"E: could not write %s\n", out_path);
+		return 1;
+	}
+
+	fwprintf(stderr, L"Wrote %s [%.1f s]\n", out_path, (timer_now() - t0)/1e9);
+
+	return 0;
+}
@@ -1,26 +1,31 @@
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
 #include "utils.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
 #ifdef __APPLE__
 
 #include <mach/mach_time.h>
 
 // Inspired by https://stackoverflow.com/a/5167506
 static double orwl_timebase = 0.0;
-static long double orwl_timestart = 0;
+static uint64_t orwl_timestart = 0;
 
-long double timer_now() {
+uint64_t timer_now() {
   // be more careful in a multithreaded environement
   if (!orwl_timestart) {
     mach_timebase_info_data_t tb;
     mach_timebase_info(&tb);
     orwl_timebase = tb.numer;
     orwl_timebase /= tb.denom;
-    orwl_timestart = (long double) mach_absolute_time();
+    orwl_timestart = mach_absolute_time();
   }
-  return (long double) (mach_absolute_time() - orwl_timestart) * orwl_timebase;
+  return (uint64_t) ((mach_absolute_time() - orwl_timestart) * orwl_timebase);
 }
 
 #else
@@ -36,20 +41,69 @@ CLOCK_PROCESS_CPUTIME_ID
 CLOCK_THREAD_CPUTIME_ID
 */
 
-long double timer_now() {
+// CLOCK_MONOTONIC never jumps back (REALTIME does when NTP steps the clock)
+uint64_t timer_now() {
 	struct timespec ts;
-	clock_gettime(CLOCK_REALTIME, &ts);
-	return (long double) ts.tv_sec + 1e-9*(long double) ts.tv_nsec;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
 }
 #endif
 
-int randi(int a, int b) {
-	return rand() % (b - a) + a;
+bool timer_use_tsc = false;
+static double timer_ns_per_tick = 1.0;
+
+// Switch timer_ticks to the TSC if it is invariant (constant rate, synchronized across cores)
+// Call once at startup, before any thread is started
+void timer_calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8))) {
+		return;
+	}
+
+	// Measure TSC rate against the monotonic clock over ~2 ms
+	uint64_t ns0 = timer_now();
+	uint64_t tsc0 = __rdtsc();
+	uint64_t ns1;
+	do {
+		ns1 = timer_now();
+	} while (ns1 - ns0 < 2000000);
+	uint64_t tsc1 = __rdtsc();
+
+	if (tsc1 > tsc0) {
+		timer_ns_per_tick = (double) (ns1 - ns0) / (tsc1 - tsc0);
+		timer_use_tsc = true;
+	}
+#endif
+}
+
+uint64_t timer_ticks_to_ns(uint64_t ticks) {
+	return timer_use_tsc ? (uint64_t) (ticks * timer_ns_per_tick) : ticks;
+}
+
+uint64_t timer_ns_to_ticks(uint64_t ns) {
+	return timer_use_tsc ? (uint64_t) (ns / timer_ns_per_tick) : ns;
+}
+
+// Every random source derives from this seed
+static uint64_t master_seed = 0;
+static uint64_t rng_streams = 0;
+
+// Seed libc & all contexts initialized afterwards; same seed, same streams
+void seed_rand(uint64_t seed) {
+	master_seed = seed;
+	rng_streams = 0;
+	srand((unsigned int) seed);
+}
+
+uint64_t rand_seed() {
+	return master_seed;
 }
 
-void seed_rand_once() {
-	srand(time(NULL));
-	// srand(42);
+// Seed a new random context: the n-th call after seed_rand always gets the same stream
+void rng_init(rng* r) {
+	uint64_t stream = __atomic_add_fetch(&rng_streams, 1, __ATOMIC_RELAXED);
+	rng_seed(r, master_seed ^ splitmix64(&stream));
 }
 
 int min(int a, int b) {
@@ -61,8 +115,8 @@ int max(int a, int b) {
 }
 
 // Pick a random item in arr that has given value
-size_t pick_value_f(const float* arr, size_t n, float val, size_t occurrences) {
-	size_t j = RANDI(0, occurrences);
+size_t pick_value_f(rng* r, const float* arr, size_t n, float val, size_t occurrences) {
+	size_t j = RANDI(r, 0, occurrences);
 	for (size_t i = 0; i < n; ++i) {
 		if (arr[i] == val && j-- == 0) {
 			return i;
@@ -72,8 +126,8 @@ size_t pick_value_f(const float* arr, size_t n, float val, size_t occurrences) {
 }
 
 // Pick a random item in arr that has given value
-size_t pick_value_i(const int* arr, size_t n, int val, size_t occurrences) {
-	size_t j = RANDI(0, occurrences);
+size_t pick_value_i(rng* r, const int* arr, size_t n, int val, size_t occurrences) {
+	size_t j = RANDI(r, 0, occurrences);
 	for (size_t i = 0; i < n; ++i) {
 		if (arr[i] == val && j-- == 0) {
 			return i;
@@ -1,22 +1,49 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include "rand.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #define MANUAL_INLINE
 
-long double timer_now();
+// Monotonic clock in nanoseconds (arbitrary origin)
+uint64_t timer_now();
+
+void timer_calibrate();
+uint64_t timer_ticks_to_ns(uint64_t);
+uint64_t timer_ns_to_ticks(uint64_t);
+
+extern bool timer_use_tsc;
+
+// Cheapest monotonic timestamp: TSC ticks once timer_calibrate found it usable, else nanoseconds
+// Only compare ticks with ticks; convert durations with timer_ticks_to_ns
+static inline uint64_t timer_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (timer_use_tsc) {
+		return __rdtsc();
+	}
+#endif
+	return timer_now();
+}
+
+#define RANDI(r,a,b) (rng_randi((r), (a), (b)))
+
+void seed_rand(uint64_t);
 
-int randi(int, int);
-#define RANDI(a,b) (rand() % ((b) - (a)) + (a))
+uint64_t rand_seed();
 
-void seed_rand_once();
+void rng_init(rng*);
 
 int min(int, int);
 int max(int, int);
 
-size_t pick_value_f(const float*, size_t, float, size_t);
-size_t pick_value_i(const int*, size_t, int, size_t);
+size_t pick_value_f(rng*, const float*, size_t, float, size_t);
+size_t pick_value_i(rng*, const int*, size_t, int, size_t);
 
 #endif
\ No newline at end of file